@@ -39,6 +39,8 @@ flags = [
     '-DKMALLOC_ALIGNMENT=4',
     '-DKMALLOC_POOL_DEPTH=10',
     '-DKMALLOC_POOL_SIZE=32768',
+    '-DKTIME_HZ=2000',
+    '-DKCRIT_CEILING=4',
     '-Iinc',
     '-Isrc',
     '-Wall',
@@ -0,0 +1,31 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALOS_DWT_H
+#define ALOS_DWT_H
+
+#include <stdint.h>
+
+//! DWT cycle counter register (not described by our CMSIS headers)
+#define DWT_CYCCNT (*(volatile uint32_t*)0xE0001004)
+
+//! Enable the cycle counter, read it with
+//!   ktime_cycles() (see kernel/ktime.h)
+void dwt_init();
+
+#endif // ALOS_DWT_H
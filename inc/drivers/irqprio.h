@@ -0,0 +1,76 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALOS_IRQPRIO_H
+#define ALOS_IRQPRIO_H
+
+#include "platform.h"
+
+// Interrupt priority map of the system (lower levels are more urgent) :
+//   0 .. KCRIT_CEILING-1   zero-latency interrupts (such as a motor
+//                          control PWM fault), never masked by kcrit
+//                          sections, they must NOT call the kernel API
+//   KCRIT_CEILING .. 12    kernel-aware interrupts, masked by kcrit
+//                          sections, they may call the kernel API
+//   13                     SVCall (system calls)
+//   14                     SysTick (kernel tick, only requests switches)
+//   15                     PendSV (context switches, the least urgent
+//                          so that a switch never interrupts anything)
+
+///////////////////////////
+//// Module parameters ////
+///////////////////////////
+
+// KCRIT_CEILING is defined at compile time
+
+//! Most urgent level, reserved to zero-latency interrupts
+#define IRQPRIO_ZERO_LATENCY 0
+
+//! Priority of the SVCall exception
+#define IRQPRIO_SVCALL 13
+
+//! Priority of the SysTick exception
+#define IRQPRIO_SYSTICK 14
+
+//! Priority of the PendSV exception
+#define IRQPRIO_PENDSV 15
+
+////////////////////////////////
+//// Module's sanity checks ////
+////////////////////////////////
+
+#ifndef KCRIT_CEILING
+#error "KCRIT_CEILING must be defined"
+#endif
+
+#if KCRIT_CEILING <= 0
+#error "KCRIT_CEILING must be strictly positive (BASEPRI = 0 masks nothing)"
+#endif
+
+#if KCRIT_CEILING > IRQPRIO_SVCALL
+#error "KCRIT_CEILING must mask the kernel's own exceptions"
+#endif
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! Convert a priority level to its register (SHP, IP, BASEPRI) encoding
+#define IRQPRIO(level) (((level) << (8 - __NVIC_PRIO_BITS)) & 0xFF)
+
+#endif // ALOS_IRQPRIO_H
@@ -19,7 +19,9 @@
 #ifndef ALOS_SYSTICK_H
 #define ALOS_SYSTICK_H
 
-void systick_init();
+#include <stdint.h>
+
+void systick_init(uint32_t reload);
 void systick_start();
 void systick_stop();
 
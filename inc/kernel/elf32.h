@@ -152,6 +152,8 @@ enum
 {
     //! Undefined or irrelevant index
     SHN_UNDEF = 0,
+    //! Lower bound of the reserved indexes
+    SHN_LORESERVE = 0xff00,
     //! Symbols defined relative to this section
     //!   are not affected by relocations and are
     //!   absolutely defined
@@ -188,7 +190,9 @@ enum
     //! Unspecified semantics
     SHT_SHLIB = 0x0A,
     //! Link-time symbol table
-    SHT_DYNSYM = 0x0B
+    SHT_DYNSYM = 0x0B,
+    //! ARM exception index table
+    SHT_ARM_EXIDX = 0x70000001
 };
 
 //! elf32_shdr.sh_flags values.
@@ -199,7 +203,11 @@ enum
     //! Occupies memory during execution of the program
     SHF_ALLOC = 0x02,
     //! Contains executable machine instructions
-    SHF_EXECINSTR = 0x04
+    SHF_EXECINSTR = 0x04,
+    //! sh_info holds a section header index
+    SHF_INFO_LINK = 0x40,
+    //! Member of a section group
+    SHF_GROUP = 0x200
 };
 
 //! The ELF32 section header structure.
@@ -242,6 +250,10 @@ typedef struct
 //// ELF32 Symbols ////
 ///////////////////////
 
+//! Index of the undefined (null) symbol, also
+//!   terminates SysV hash chains
+#define STN_UNDEF 0
+
 //! Get the bind attribute of a symbol.
 #define ELF32_ST_BIND(st_info) ((st_info) >> 4)
 //! Get the type attribute of a symbol.
@@ -310,10 +322,32 @@ typedef struct
 
 enum
 {
+    //! No relocation
+    R_ARM_NONE = 0x00,
     //! (S + A) | T
     R_ARM_ABS32 = 0x02,
     //! ((S + A) | T) - P
-    R_ARM_THM_CALL = 0x0A
+    R_ARM_REL32 = 0x03,
+    //! ((S + A) | T) - P
+    R_ARM_THM_CALL = 0x0A,
+    //! ((S + A) | T) - P
+    R_ARM_THM_JUMP24 = 0x1E,
+    //! B + A, dynamic relocation against the load address
+    R_ARM_RELATIVE = 0x17,
+    //! Platform defined, ABS32 for us
+    R_ARM_TARGET1 = 0x26,
+    //! Marker for ARMv4 BX instructions, no-op
+    R_ARM_V4BX = 0x28,
+    //! ((S + A) | T) - P, 31 bits
+    R_ARM_PREL31 = 0x2A,
+    //! (S + A) | T, lower 16 bits
+    R_ARM_THM_MOVW_ABS_NC = 0x2F,
+    //! S + A, upper 16 bits
+    R_ARM_THM_MOVT_ABS = 0x30,
+    //! S + A - P, 16-bit unconditional branch
+    R_ARM_THM_JUMP11 = 0x66,
+    //! S + A - P, 16-bit conditional branch
+    R_ARM_THM_JUMP8 = 0x67
 };
 
 //! An ELF32 relocation table entry.
@@ -328,4 +362,97 @@ typedef struct
     elf32_word r_info;
 } elf32_rel;
 
+///////////////////////////////
+//// ELF32 Program headers ////
+///////////////////////////////
+
+//! elf32_phdr.p_type values.
+enum
+{
+    //! Unused entry
+    PT_NULL = 0x00,
+    //! Loadable segment
+    PT_LOAD = 0x01,
+    //! Dynamic linking information
+    PT_DYNAMIC = 0x02,
+    //! Path of an interpreter
+    PT_INTERP = 0x03,
+    //! Auxiliary information
+    PT_NOTE = 0x04,
+    //! The program header table itself
+    PT_PHDR = 0x06,
+    //! ARM exception index table
+    PT_ARM_EXIDX = 0x70000001
+};
+
+//! elf32_phdr.p_flags values.
+enum
+{
+    //! Executable segment
+    PF_X = 0x01,
+    //! Writable segment
+    PF_W = 0x02,
+    //! Readable segment
+    PF_R = 0x04
+};
+
+//! The ELF32 program header structure.
+typedef struct
+{
+    //! Kind of segment (see PT_*)
+    elf32_word p_type;
+    //! Byte offset from the beginning of the file
+    //!   to the first byte of the segment
+    elf32_off p_offset;
+    //! Virtual address of the segment's first byte
+    elf32_addr p_vaddr;
+    //! Physical address of the segment (unused)
+    elf32_addr p_paddr;
+    //! Size of the segment in the file
+    elf32_word p_filesz;
+    //! Size of the segment in memory, the bytes
+    //!   after p_filesz are zeroed
+    elf32_word p_memsz;
+    //! Segment attributes (see PF_*)
+    elf32_word p_flags;
+    //! Alignment constraints of the segment
+    elf32_word p_align;
+} elf32_phdr;
+
+///////////////////////////////
+//// ELF32 Dynamic section ////
+///////////////////////////////
+
+//! elf32_dyn.d_tag values.
+enum
+{
+    //! Ends the dynamic section
+    DT_NULL = 0,
+    //! Name of a needed shared library
+    DT_NEEDED = 1,
+    //! Address of the global offset table
+    DT_PLTGOT = 3,
+    //! Address of a relocation table with explicit addends
+    DT_RELA = 7,
+    //! Address of the relocation table
+    DT_REL = 17,
+    //! Size in bytes of the DT_REL table
+    DT_RELSZ = 18,
+    //! Size in bytes of a DT_REL entry
+    DT_RELENT = 19,
+    //! Relocations may modify a non-writable segment
+    DT_TEXTREL = 22,
+    //! Address of the PLT relocation table
+    DT_JMPREL = 23
+};
+
+//! An ELF32 dynamic section entry.
+typedef struct
+{
+    //! Kind of entry (see DT_*)
+    elf32_sword d_tag;
+    //! Value or address, depending on d_tag
+    elf32_word d_val;
+} elf32_dyn;
+
 #endif // ALOS_ELF32_H
@@ -67,6 +67,10 @@ struct superblock
     //! (FSF_RAM only)
     int (*rawptr)(struct inode*, void**, int*);
 
+    //! Read from a file at the given offset, returning
+    //!   the number of bytes read (0 past the end of file)
+    int (*read)(struct inode*, int, void*, int);
+
     // @TODO: more operations here
 };
 
@@ -62,4 +62,13 @@ int vfs_mkdir(struct inode* node, const char* name);
 //! \return 0 if OK, -1 otherwise
 int vfs_rawptr(struct inode* node, void** ptr, int* size);
 
+//! Read from a file
+//! \param node The inode
+//! \param offset Offset in the file to read from
+//! \param buf The buffer to read into
+//! \param size Number of bytes to read
+//! \return The number of bytes read (less than size only at
+//!         the end of the file), -1 upon failure
+int vfs_read(struct inode* node, int offset, void* buf, int size);
+
 #endif // ALOS_VFS_H
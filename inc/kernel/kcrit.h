@@ -0,0 +1,77 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALOS_KCRIT_H
+#define ALOS_KCRIT_H
+
+#include "platform.h"
+#include "drivers/irqprio.h"
+
+// When KCRIT_STATS is defined (add -DKCRIT_STATS to the Makefile
+//   DEFINES), the outermost critical sections are timed with the
+//   DWT cycle counter, giving the worst case interrupt masking time.
+#ifdef KCRIT_STATS
+#include "drivers/dwt.h"
+
+extern uint32_t kcrit_stats_start;
+void kcrit_stats_stop();
+#endif
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+//! Enter a kernel critical section, masking interrupts up
+//!   to the kernel ceiling (KCRIT_CEILING) by raising BASEPRI.
+//! More urgent interrupts are never masked.
+//! Critical sections can be nested, as long as each
+//!   state is given back to kcrit_exit() in reverse order.
+//! \return The interrupt state to restore on exit
+static inline uint32_t kcrit_enter()
+{
+    uint32_t state;
+    asm volatile("mrs %0, basepri" : "=r"(state));
+    // basepri_max only ever raises the masking level
+    asm volatile("msr basepri_max, %0" : : "r"(IRQPRIO(KCRIT_CEILING)) : "memory");
+    // Make sure the new mask is in effect before going on
+    asm volatile("isb" : : : "memory");
+#ifdef KCRIT_STATS
+    if (!state)
+        kcrit_stats_start = DWT_CYCCNT;
+#endif
+    return state;
+}
+
+//! Leave a kernel critical section
+//! \param state The value returned by the matching kcrit_enter()
+static inline void kcrit_exit(uint32_t state)
+{
+#ifdef KCRIT_STATS
+    if (!state)
+        kcrit_stats_stop();
+#endif
+    asm volatile("msr basepri, %0" : : "r"(state) : "memory");
+}
+
+//! Get the longest time spent in a critical section
+//!   since the last reset (always 0 without KCRIT_STATS).
+//! \param reset Restart the measurement if not 0
+//! \return The maximum masking time, in CPU cycles
+uint32_t kcrit_max_cycles(int reset);
+
+#endif // ALOS_KCRIT_H
@@ -19,6 +19,8 @@
 #ifndef ALOS_KELF_H
 #define ALOS_KELF_H
 
+#include <stdint.h>
+
 ///////////////////////////////////////
 //// Module's forward declarations ////
 ///////////////////////////////////////
@@ -27,18 +29,72 @@
 //!   ELF binary in the memory
 typedef struct kelf kelf;
 
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! Load flags
+enum
+{
+    //! Execute read-only sections in place : they are
+    //!   relocated inside the blob itself instead of being
+    //!   copied to program memory. The blob must be writable,
+    //!   and it is restored when the elf is unloaded.
+    KELF_F_XIP = 0x01,
+    //! Bind calls to external functions lazily : they go through
+    //!   stubs that look the symbol up on the first call only.
+    //!   Calling a symbol that can't be resolved kills the calling
+    //!   task (see ksched_exit()), instead of failing the load. In
+    //!   an interrupt handler, that can't be killed, it hangs.
+    KELF_F_LAZY = 0x02,
+    //! The blob was allocated with kmalloc, and belongs to
+    //!   the kernel elf object once loaded : it is freed by
+    //!   kelf_finalize() or kelf_unload()
+    KELF_F_OWNED = 0x04
+};
+
+//! Source of an elf read piece by piece, instead
+//!   of being held whole in memory
+struct kelf_reader
+{
+    //! Read size bytes at offset in the file
+    //! \param ctx The reader's context
+    //! \param offset Offset in the file
+    //! \param buf The destination buffer
+    //! \param size Number of bytes to read
+    //! \return 0 if all bytes were read, -1 otherwise
+    int (*read)(void* ctx, uint32_t offset, void* buf, uint32_t size);
+    //! Context passed to read
+    void* ctx;
+};
+
 /////////////////////////////
 //// Public module's API ////
 /////////////////////////////
 
 //! Load and prepare for execution an elf blob
-//!   from memory. If some relocations haven't been
+//!   from memory (or a prelinked module image, see
+//!   kmodimg.h). If some relocations haven't been
 //!   resolved, kelf_needs_fix() will return 1, and one
 //!   must call kelf_fix_relocations() once all required
 //!   symbols has been exported.
 //! \param raw A pointer to the raw elf blob buffer
+//! \param flags Load flags (see KELF_F_*)
 //! \return A kernel elf object, 0 if error(s) occured
-kelf* kelf_load(void* raw);
+kelf* kelf_load(void* raw, int flags);
+
+//! Load and prepare for execution an elf (or a prelinked
+//!   module image) read through a reader : only its tables are
+//!   kept in memory until kelf_finalize(), sections are read
+//!   straight into program memory and relocations by chunks.
+//!   Same as kelf_load() otherwise, except that nothing is
+//!   executed in place (KELF_F_XIP and KELF_F_OWNED are ignored).
+//!   The reader must remain usable until kelf_finalize() or
+//!   kelf_unload().
+//! \param reader Where to read the elf from
+//! \param flags Load flags (see KELF_F_*)
+//! \return A kernel elf object, 0 if error(s) occured
+kelf* kelf_load_stream(const struct kelf_reader* reader, int flags);
 
 //! Get the relocation state of the kernel elf.
 //! \param elf The elf to work on
@@ -51,6 +107,17 @@ int kelf_needs_fix(kelf* elf);
 //! \return 0 if OK, -1 if there remains unsatisfied relocations
 int kelf_fix_relocations(kelf* elf);
 
+//! Release everything that was only needed to load
+//!   the elf : section and relocation tables, symbol
+//!   index and the blob itself (if owned, see KELF_F_OWNED),
+//!   unless some sections are executed in place.
+//!   The exported symbols are kept in a compact table, so
+//!   that kelf_symbol() still works.
+//!   All relocations must be satisfied.
+//! \param elf The elf object to finalize
+//! \return 0 if OK, -1 otherwise
+int kelf_finalize(kelf* elf);
+
 //! Unload and release a kernel elf object
 //! \param elf The elf object to release
 void kelf_unload(kelf* elf);
@@ -0,0 +1,80 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALOS_KINIT_H
+#define ALOS_KINIT_H
+
+#include <stdint.h>
+
+// The boot sequence is a table of steps, each one declaring the
+//   steps it depends on. Immediate steps run in order before the
+//   scheduler starts, deferred ones are run in the background by
+//   a low priority init task, so that time-critical tasks do not
+//   wait for them. Tasks can wait for any step to complete.
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! Maximum number of boot steps
+#define KINIT_MAX_STEPS 32
+
+//! Build a dependency mask from a step index
+#define KINIT_DEP(step) (1u << (step))
+
+//! A boot step
+struct kinit_step
+{
+    //! Name of the step, for the log
+    const char* name;
+    //! The step's work, returns 0 if OK and -1 otherwise
+    int (*run)();
+    //! Steps that must have completed before this one
+    //!   (see KINIT_DEP())
+    uint32_t depends;
+    //! Set to 1 to run the step in the init task
+    int deferred;
+};
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+//! Run the immediate steps of a boot sequence, in order, and
+//!   spawn the init task that will run the deferred ones once
+//!   the scheduler is started. Steps may only depend on earlier
+//!   ones, and immediate steps can't depend on deferred ones. A
+//!   step whose dependencies failed fails too.
+//! The scheduler must be initialized by an immediate step.
+//! \param steps The boot sequence, it must not be allocated
+//! \param count Number of steps
+//! \return 0 if all immediate steps succeeded, -1 otherwise
+int kinit_run(const struct kinit_step* steps, int count);
+
+//! Wait until a boot step is over (blocking call, from a task)
+//! \param step The step's index
+//! \return 0 if it succeeded, -1 if it failed
+int kinit_wait(int step);
+
+//! Check if a boot step is over
+//! \param step The step's index
+//! \return 1 if it succeeded, 0 if it's not over yet, -1
+//!         if it failed
+int kinit_done(int step);
+
+#endif // ALOS_KINIT_H
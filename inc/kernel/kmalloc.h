@@ -19,6 +19,19 @@
 #ifndef ALOS_KMALLOC_H
 #define ALOS_KMALLOC_H
 
+// Every block belongs to an arena : the one the running task
+//   was using (see kmalloc_arena_use()) when it was allocated, tasks
+//   start with the arena of their parent. The kernel's
+//   arena is always there, others are created for modules so that
+//   whatever they allocated can be released at once.
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! The kernel's arena
+#define KMALLOC_ARENA_KERNEL 0
+
 /////////////////////////////
 //// Public module's API ////
 /////////////////////////////
@@ -35,7 +48,8 @@ int kmalloc_init();
 void* kmalloc(int size);
 
 //! Request the reallocation of a block with a new size (copying
-//!   data across the two buffers).
+//!   data across the two buffers). The new block stays in
+//!   the old one's arena.
 //! \param ptr The base address of the old block
 //! \param size The new size of the block (may be < or >)
 //! \return The base address of the newly allocated block or 0
@@ -46,4 +60,26 @@ void* krealloc(void* ptr, int size);
 //! \param ptr The base address of the block to release
 void kfree(void* ptr);
 
+//! Create a new, empty arena.
+//! \return The arena's identifier, -1 if there are too many
+int kmalloc_arena_create();
+
+//! Account the blocks the running task allocates from now
+//!   on to an arena.
+//! \param arena The arena to use
+//! \return The arena that was in use before (to be restored
+//!         later on), -1 upon failure
+int kmalloc_arena_use(int arena);
+
+//! Get the arena in use by the running task.
+//! \return The arena's identifier
+int kmalloc_arena_current();
+
+//! Release all blocks of an arena, and the arena itself.
+//!   It must not be in use, neither by the running task nor
+//!   by any live task, and the kernel's one can't be released.
+//! \param arena The arena to release
+//! \return The number of blocks released, -1 upon failure
+int kmalloc_arena_release(int arena);
+
 #endif // ALOS_KMALLOC_H
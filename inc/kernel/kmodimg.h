@@ -0,0 +1,102 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALOS_KMODIMG_H
+#define ALOS_KMODIMG_H
+
+#include <stdint.h>
+
+// A prelinked module image is produced on the host by tools/modpost.c
+//   from a module's relocatable ELF and the kernel ELF. All relocations
+//   against kernel symbols and between the module's own sections are
+//   applied beforehand, so that loading it only takes a copy followed
+//   by a fixup pass adding the load address where needed.
+// This header is shared with the host tool, so it only relies on
+//   fixed-size types.
+//
+// Layout (all parts are 4-byte aligned) :
+//   - struct kmodimg_header
+//   - image contents (copy_size bytes)
+//   - fixup stream (fixups_size bytes)
+//   - imports (nimports struct kmodimg_symbol)
+//   - exports (nexports struct kmodimg_symbol)
+//   - string table (strtab_size bytes)
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! Image magic number ("KIMG")
+#define KMODIMG_MAGIC 0x474d494b
+
+//! Round up a size to the image alignment
+#define KMODIMG_ALIGN(size) (((size) + 3) & ~3)
+
+//! Fixup kinds, stored in the low bits of each fixup entry
+enum
+{
+    //! Add the load address to a 32-bit word
+    KMODIMG_FIX_WORD = 0,
+    //! Add the load address to a Thumb MOVW immediate
+    KMODIMG_FIX_MOVW = 1,
+    //! Add the load address to a Thumb MOVT immediate, the entry
+    //!   is followed by the lower half of the original value
+    KMODIMG_FIX_MOVT = 2,
+
+    //! Number of bits used by the kind
+    KMODIMG_FIX_BITS = 2
+};
+
+//! Prelinked module image header
+struct kmodimg_header
+{
+    //! Always KMODIMG_MAGIC
+    uint32_t magic;
+    //! Checksum of the kernel symbol table the image was
+    //!   linked against (see ksymtab_checksum())
+    uint32_t ksymtab_sum;
+    //! Size of the program image in memory
+    uint32_t load_size;
+    //! Size of the initialized part of the program image,
+    //!   the remaining bytes are zeroed
+    uint32_t copy_size;
+    //! Size of the fixup stream in bytes. Each entry is an
+    //!   ULEB128 number holding the distance from the previous
+    //!   fixup in half-words, shifted left by KMODIMG_FIX_BITS,
+    //!   ORed with the fixup kind
+    uint32_t fixups_size;
+    //! Number of symbols to resolve at load time
+    uint32_t nimports;
+    //! Number of symbols exported by the module
+    uint32_t nexports;
+    //! Size of the string table in bytes
+    uint32_t strtab_size;
+};
+
+//! An imported or exported symbol
+struct kmodimg_symbol
+{
+    //! Offset of the symbol's name in the string table
+    uint32_t name;
+    //! For imports, offset of the word to which the symbol's
+    //!   address is added. For exports, offset of the symbol
+    //!   (with the Thumb bit set for functions).
+    uint32_t offset;
+};
+
+#endif // ALOS_KMODIMG_H
@@ -52,6 +52,17 @@ typedef struct kmodule kmodule;
 //!        also load unsatisfied depencies
 kmodule* kmodule_insert(const char* name, int load_deps);
 
+//! Load and initialize a set of modules and all their
+//!   dependencies at once : every file is read first, then the
+//!   modules are linked and initialized in dependency order so
+//!   that each one is relocated a single time. A timing breakdown
+//!   is traced for each module.
+//! \param names The names of the modules
+//! \param count Number of names
+//! \return 0 if all modules were inserted, -1 otherwise (the
+//!         ones that could be are inserted anyway)
+int kmodule_insert_set(const char** names, int count);
+
 //! Remove a module from the kernel
 //! \param name The name of the module to remove
 //! \param unload_deps Set to 1 if you want to
@@ -0,0 +1,49 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALOS_KPROG_H
+#define ALOS_KPROG_H
+
+// User programs are position-independent ELF executables, run as
+//   tasks. They must be compiled with
+//     -fPIE -msingle-pic-base -mpic-register=r9
+//     -mno-pic-data-is-text-relative
+//   and linked with -pie -nostartfiles (the ELF entry point being a
+//   void entry(void* arg) function), against libksys only : no shared
+//   library is loaded for them. Code and read-only data never move
+//   with respect to each other, while all accesses to writable data
+//   go through the global offset table, pointed to by r9.
+// All instances of a program share a single copy of its read-only
+//   segment (executed in place from RAM filesystems), each one only
+//   gets its own data segment and global offset table.
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+//! Load a program and start an instance of it in a new
+//!   task, named after the program's file. The image is kept
+//!   as long as one of its instances is running, and
+//!   everything an instance allocates is released when
+//!   it returns.
+//! \param path Path of the program's executable file
+//! \param arg Argument to pass to the program's entry point
+//! \return The pid of the spawned task, -1 if error(s) occured
+int kprog_spawn(const char* path, void* arg);
+
+#endif // ALOS_KPROG_H
@@ -32,6 +32,32 @@ struct ksched_policy;
 //// Module's definitions ////
 //////////////////////////////
 
+//! Task priorities, higher values are served first.
+//! The idle task is the only one running at
+//!   KSCHED_PRIO_IDLE.
+enum
+{
+    //! Reserved for the idle task
+    KSCHED_PRIO_IDLE = 0,
+    //! Lowest priority for a regular task
+    KSCHED_PRIO_MIN = 1,
+    //! Priority given to newly spawned tasks
+    KSCHED_PRIO_DEFAULT = 8,
+    //! Highest priority for a task
+    KSCHED_PRIO_MAX = 15
+};
+
+//! Values of the ktask.state field
+enum
+{
+    //! The task can be scheduled
+    KTASK_READY = 0x00,
+    //! The task waits for a ksched_wakeup()
+    KTASK_SLEEPING = 0x01,
+    //! The task has exited and waits to be reaped
+    KTASK_DEAD = 0x02
+};
+
 //! The kernel structure representing a
 //!   task.
 struct ktask
@@ -46,11 +72,20 @@ struct ktask
     //!   freed without seeing what's inside
     void* sched_data;
 
+    //! Scheduling priority (see KSCHED_PRIO_*)
+    int prio;
+    //! Current state of the task (see KTASK_*)
+    volatile int state;
+
     //! Address of this task's stack page
     void* page;
     //! Address of the saved stack pointer of the task
     void* sp;
 
+    //! The kmalloc arena the task allocates from (see
+    //!   kmalloc_arena_use()), inherited from its parent
+    int arena;
+
     //! Pointer to the previous task in the doubly
     //!   linked list
     struct ktask* prev;
@@ -83,6 +118,7 @@ struct ksched_policy
     //!  is the first element of the tasks list, the second
     //!  one is a pointer to the current task, and must be set
     //!  before returning from this function to the scheduled task
+    //! Only tasks in the KTASK_READY state may be elected
     int (*schedule)(struct ktask*, struct ktask**);
 };
 
@@ -91,18 +127,30 @@ struct ksched_policy
 /////////////////////////////
 
 //! Initialize the kernel scheduler, do not launch any
-//!   task for now.
-//! The scheduling policy is initially set to the default one, a very
-//!   simple round-robin scheduler
+//!   task for now (only the idle task is created).
+//! The kernel clock (ktime) must have been initialized.
+//! The scheduling policy is initially set to the default one, a
+//!   simple priority-based round-robin scheduler
 //! \return 0 if scheduler is initialized OK, -1 otherwise
 int ksched_init();
 
+//! Start the scheduler, switching to the first
+//!   spawned task. This never returns if successful
+//! \return -1 if the scheduler could not be started
+int ksched_start();
+
 //! Retrieve a task given its pid
 //!   (linear in time)
 //! \param pid The pid to search
 //! \return The found task, 0 if not found
 struct ktask* ksched_task_by_pid(int pid);
 
+//! Count the live tasks allocating from a kmalloc
+//!   arena (linear in time)
+//! \param arena The arena
+//! \return The number of tasks
+int ksched_arena_tasks(int arena);
+
 //! Change the current scheduling policy
 //! This resets any policy-specific data in all tasks,
 //!   resetting them to the default values using
@@ -114,8 +162,8 @@ int ksched_change_policy(struct ksched_policy* policy);
 //! Spawn a task
 //! This is used as a basic service by kernel threads
 //!   and user program loading
-//! The first call to this function will start the scheduler,
-//!   and therefore never return (if succesful)
+//! Tasks spawned before ksched_start() will run once
+//!   the scheduler is started
 //! \param name ASCII string containing the name of the task,
 //!             must not be allocated
 //! \param start Start address to jump to when starting the task
@@ -123,4 +171,41 @@ int ksched_change_policy(struct ksched_policy* policy);
 //! \return The pid (> 1) of the spawned task if OK, -1 otherwise
 int ksched_spawn(const char* name, void* start, void* arg);
 
+//! Change the priority of a task
+//! \param pid The pid of the task
+//! \param prio The new priority, between KSCHED_PRIO_MIN
+//!             and KSCHED_PRIO_MAX
+//! \return 0 if OK, -1 otherwise
+int ksched_set_priority(int pid, int prio);
+
+//! Get the currently running task
+//! \return The current task, 0 if the scheduler is not started
+struct ktask* ksched_current();
+
+//! Get the pid of the currently running task
+//! \return The current task's pid, -1 if the scheduler is not started
+int ksched_getpid();
+
+//! Give up the processor, the scheduler will
+//!   elect the next task to run
+void ksched_yield();
+
+//! Put the current task to sleep until someone calls
+//!   ksched_wakeup() on it.
+//! The switch happens as soon as interrupts are unmasked, so
+//!   calling this inside a critical section, after having checked
+//!   the sleeping condition, is race-free.
+void ksched_sleep();
+
+//! Terminate the current task, as if it returned
+//!   from its entry point
+//! \return Does not return if called from a task,
+//!         -1 if called from an interrupt handler
+int ksched_exit();
+
+//! Wake up a sleeping task (may be called from interrupt handlers)
+//! \param task The task to wake up
+//! \return 0 if OK, -1 otherwise
+int ksched_wakeup(struct ktask* task);
+
 #endif // ALOS_KSCHED_H
@@ -19,11 +19,43 @@
 #ifndef ALOS_KSYMBOLS_H
 #define ALOS_KSYMBOLS_H
 
+#include <stdint.h>
+
+// Kernel symbols come from two places :
+//   - symbols exported with EXPORT_KSYMBOL() are gathered at link
+//     time in a table stored in flash, sorted by name (see link.lds)
+//   - symbols registered at run time with ksymbol_add() (by modules)
+//     are stored in a small hash table in RAM
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! A kernel symbol table entry
+struct ksymbol_entry
+{
+    //! Name of the kernel symbol (must be unique)
+    const char* name;
+    //! Location of the kernel symbol
+    void* location;
+};
+
+//! Export a kernel symbol, this must be used at file scope,
+//!   after the symbol's declaration.
+//! Each entry goes in its own .ksymtab.<name> section, and the
+//!   linker sorts them by section name (thus by symbol name).
+#define EXPORT_KSYMBOL(sym)                                               \
+    static const char _ksymtab_name_##sym[] = #sym;                       \
+    static const struct ksymbol_entry _ksymtab_##sym                      \
+        __attribute__((used, section(".ksymtab." #sym))) = {_ksymtab_name_##sym, \
+                                                           (void*)&(sym)}
+
 /////////////////////////////
 //// Public module's API ////
 /////////////////////////////
 
-//! Register a symbol in the kernel's symbol table.
+//! Register a symbol in the kernel's symbol table, replacing
+//!   the previous run time symbol with the same name if any.
 //! \param name A null-terminated string containing
 //!             the name of the symbol to register
 //! \param location A pointer to the symbol
@@ -35,10 +67,22 @@ int ksymbol_add(const char* name, void* location);
 //! \return 0 if success, -1 otherwise
 int ksymbol_remove(const char* name);
 
+//! Remove all the run time symbols added while a given
+//!   kmalloc arena was in use (see kmalloc_arena_use()).
+//! \param arena The arena
+//! \return The number of symbols removed
+int ksymbol_remove_arena(int arena);
+
 //! Search for a symbol in the table.
 //! \param name The name of the symbol to resolve
 //! \return A pointer to the found symbol if found,
 //!         0 otherwise
 void* ksymbol(const char* name);
 
+//! Get a checksum of the link-time symbol table (FNV-1a of its
+//!   raw contents), prelinked module images record the one of
+//!   the kernel they were linked against.
+//! \return The checksum
+uint32_t ksymtab_checksum();
+
 #endif // ALOS_KSYMBOLS_H
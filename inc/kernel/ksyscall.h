@@ -27,6 +27,9 @@
 
 //! Init the system call module.
 //! This must be done early in the kernel boot.
+//! System calls run in thread mode on the calling task's
+//!   stack, with interrupts enabled : they can be preempted
+//!   and must protect shared kernel state with kcrit sections.
 //! \return 0 if OK, -1 otherwise
 int ksyscall_init();
 
@@ -19,17 +19,60 @@
 #ifndef ALOS_KSYSMAP_H
 #define ALOS_KSYSMAP_H
 
+#include <stdint.h>
+
+// When KSYSMAP_STATS is defined (add -DKSYSMAP_STATS to the Makefile
+//   DEFINES), each syscall's latency is measured with the DWT cycle
+//   counter, from its issue to its return (including the time it
+//   was preempted or blocked).
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! Number of buckets in the latency histograms
+#define KSYSMAP_HIST_BUCKETS 24
+
+//! Statistics of a system call
+struct ksysmap_stats
+{
+    //! Number of completed calls
+    uint32_t count;
+    //! Longest call, in cycles
+    uint32_t max;
+    //! Total time spent, in cycles
+    uint64_t total;
+    //! Log2 latency histogram : bucket i counts calls that took
+    //!   [2^i, 2^(i+1)[ cycles, the last one all longer calls
+    uint32_t hist[KSYSMAP_HIST_BUCKETS];
+};
+
 /////////////////////////////
 //// Public module's API ////
 /////////////////////////////
 
-//! Jump to the appropriate syscall, given its id.
-//! \param id The identifier of the system call (in the above array)
-//! \param a0 The first argument for the syscall (if applicable)
-//! \param a1 The second argument for the syscall (if applicable)
-//! \param a2 The third argument for the syscall (if applicable)
+//! The system call table, indexed by syscall id.
+//! Null entries are invalid syscalls (they return -1
+//!   to the calling task).
+extern void* const ksysmap[];
+
+//! Number of entries in the system call table
+extern const int ksysmap_count;
+
+//! Run a system call from kernel code, as if
+//!   called by the current task.
+//! \param id The identifier of the system call
+//! \param args The 6 arguments to pass (unused ones are ignored)
 //! \return The return value of the syscall, -1 if invalid id
 //!         or null syscall handler address
-int ksysmap_jump(int id, void* a0, void* a1, void* a2);
+int ksysmap_call(int id, const uint32_t* args);
+
+//! Get the statistics of a system call (this is also
+//!   a system call).
+//! \param id The identifier of the system call
+//! \param out Where to copy the statistics
+//! \param reset Clear the statistics after reading them if not 0
+//! \return 0 if OK, -1 if invalid id or not built with KSYSMAP_STATS
+int ksysmap_stats(int id, struct ksysmap_stats* out, int reset);
 
 #endif // ALOS_KSYSMAP_H
@@ -0,0 +1,150 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALOS_KSYSRING_H
+#define ALOS_KSYSRING_H
+
+#include <stdint.h>
+
+// A system call ring lets a task batch system calls : it fills
+//   submission entries (SQEs) with sysmap.h operations, then a single
+//   ksysring_enter() call runs them in order and posts their results
+//   as completion entries (CQEs). With KSYSRING_F_POLL, a kernel
+//   worker picks up submitted entries by itself, and no syscall at
+//   all is needed. The worker allocates in the task's kmalloc arena
+//   (and so do the tasks it spawns), but it can't take the task's
+//   identity : ksched_getpid() fails with -1 in a polled ring.
+// The ring and both entry arrays belong to the task, the kernel
+//   only advances sq_head and cq_tail.
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! Ring setup flags
+enum
+{
+    //! Submitted entries are polled for by a kernel worker
+    KSYSRING_F_POLL = 0x01
+};
+
+//! A submission entry
+struct ksysring_sqe
+{
+    //! Syscall id (see sysmap.h)
+    uint32_t id;
+    //! Opaque value, copied in the completion entry
+    uint32_t user;
+    //! The syscall's arguments
+    uint32_t args[6];
+};
+
+//! A completion entry
+struct ksysring_cqe
+{
+    //! The user value of the submission entry
+    uint32_t user;
+    //! The syscall's return value
+    int32_t result;
+};
+
+//! A submission / completion ring pair
+struct ksysring
+{
+    //! Number of entries of both arrays (must be a power of 2)
+    uint32_t size;
+    //! Next SQE to run (written by the kernel)
+    volatile uint32_t sq_head;
+    //! Next SQE to fill (written by the task)
+    volatile uint32_t sq_tail;
+    //! Next CQE to read (written by the task)
+    volatile uint32_t cq_head;
+    //! Next CQE to post (written by the kernel)
+    volatile uint32_t cq_tail;
+    //! Submission entries
+    struct ksysring_sqe* sq;
+    //! Completion entries
+    struct ksysring_cqe* cq;
+};
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+//! Init the system call ring module.
+//! The timer service and the work queues (that run
+//!   the polled rings) must have been initialized.
+//! \return 0 if OK, -1 otherwise
+int ksysring_init();
+
+//! Register a ring for the current task, replacing
+//!   its previous one if any (system call).
+//! \param ring The ring to register, 0 to unregister
+//! \param flags Setup flags (see KSYSRING_F_*)
+//! \return 0 if OK, -1 otherwise
+int ksysring_setup(struct ksysring* ring, int flags);
+
+//! Run submitted entries of the current task's ring (system call).
+//! \param to_submit Maximum number of entries to run
+//! \return The number of entries run, -1 if error(s) occured
+int ksysring_enter(int to_submit);
+
+//! Drop the ring registered by the current task, if any, so
+//!   that its slot and pid can be reused (called by the
+//!   scheduler when a task exits)
+void ksysring_exit();
+
+//! Get the next free submission entry of a ring
+//! \param ring The ring
+//! \return The entry to fill, 0 if the ring is full
+static inline struct ksysring_sqe* ksysring_get_sqe(struct ksysring* ring)
+{
+    if (ring->sq_tail - ring->sq_head >= ring->size)
+        return 0;
+
+    return &ring->sq[ring->sq_tail & (ring->size - 1)];
+}
+
+//! Publish the entry obtained by ksysring_get_sqe()
+//! \param ring The ring
+static inline void ksysring_submit(struct ksysring* ring)
+{
+    asm volatile("dmb" : : : "memory");
+    ring->sq_tail++;
+}
+
+//! Get the oldest completion entry of a ring
+//! \param ring The ring
+//! \return The entry, 0 if there is none
+static inline struct ksysring_cqe* ksysring_peek_cqe(struct ksysring* ring)
+{
+    if (ring->cq_head == ring->cq_tail)
+        return 0;
+
+    asm volatile("dmb" : : : "memory");
+    return &ring->cq[ring->cq_head & (ring->size - 1)];
+}
+
+//! Release the entry obtained by ksysring_peek_cqe()
+//! \param ring The ring
+static inline void ksysring_cqe_seen(struct ksysring* ring)
+{
+    ring->cq_head++;
+}
+
+#endif // ALOS_KSYSRING_H
@@ -0,0 +1,73 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALOS_KTIME_H
+#define ALOS_KTIME_H
+
+#include "platform.h"
+#include "drivers/dwt.h"
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+//! Init the kernel clock. The SysTick period is derived
+//!   from SystemCoreClock and KTIME_HZ (defined in the Makefile),
+//!   the DWT cycle counter is also started.
+//! This must be done before the scheduler is started.
+//! \return 0 if OK, -1 otherwise
+int ktime_init();
+
+//! Count an elapsed SysTick period, this is called
+//!   by the scheduler on each SysTick interrupt
+void ktime_tick();
+
+//! Get the number of SysTick periods elapsed since boot
+//! \return The tick count
+uint64_t ktime_ticks();
+
+//! Get the monotonic time since boot, in processor cycles.
+//! This is consistent across tick wraparound and preemption,
+//!   and may be called from any context.
+//! \return The elapsed cycles count
+uint64_t ktime_now_cycles();
+
+//! Get the monotonic time since boot, in nanoseconds
+//! \return The elapsed time in ns
+uint64_t ktime_now();
+
+//! Convert a cycle count to nanoseconds
+//! \param cycles The cycle count to convert
+//! \return The corresponding duration in ns
+uint64_t ktime_cycles_to_ns(uint64_t cycles);
+
+//! Convert a duration to a number of ticks (rounded up)
+//! \param ns The duration in ns
+//! \return The corresponding tick count
+uint64_t ktime_ns_to_ticks(uint64_t ns);
+
+//! Read the free-running 32-bit processor cycle counter,
+//!   cheapest way to measure short intervals (it wraps
+//!   around every 2^32 cycles, so only use differences)
+//! \return The current cycle counter value
+static inline uint32_t ktime_cycles()
+{
+    return DWT_CYCCNT;
+}
+
+#endif // ALOS_KTIME_H
@@ -0,0 +1,84 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALOS_KTIMER_H
+#define ALOS_KTIMER_H
+
+///////////////////////////////////////
+//// Module's forward declarations ////
+///////////////////////////////////////
+
+//! Opaque struct representing a kernel
+//!   software timer
+typedef struct ktimer ktimer;
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! Timer creation flags
+enum
+{
+    //! The timer fires once, then stays stopped
+    KTIMER_ONESHOT = 0x00,
+    //! The timer is re-armed each time it fires
+    KTIMER_PERIODIC = 0x01
+};
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+//! Init the timer wheel and spawn the timer service
+//!   thread, which runs the expired timers' callbacks.
+//! The scheduler must have been initialized.
+//! \return 0 if OK, -1 otherwise
+int ktimer_init();
+
+//! Create a (stopped) timer
+//! \param callback The function to call when the timer expires,
+//!                 it runs in the timer service thread
+//! \param arg The argument to pass to the callback
+//! \param flags Timer flags (see KTIMER_*)
+//! \return The created timer, 0 if error(s) occured
+ktimer* ktimer_create(void (*callback)(void*), void* arg, int flags);
+
+//! Arm a timer (re-arming it if it was already started)
+//! This takes constant time, and may be called from interrupt handlers.
+//! \param timer The timer to start
+//! \param ticks Delay (and period for periodic timers) in scheduler ticks,
+//!              there are KTIME_HZ ticks per second (see ktime_ns_to_ticks())
+//! \return 0 if OK, -1 otherwise
+int ktimer_start(ktimer* timer, int ticks);
+
+//! Disarm a timer. If it has already expired but its callback
+//!   has not run yet, the callback is cancelled.
+//! This takes constant time, and may be called from interrupt handlers.
+//! \param timer The timer to stop
+//! \return 0 if OK, -1 otherwise
+int ktimer_stop(ktimer* timer);
+
+//! Stop and release a timer
+//! \param timer The timer to destroy
+void ktimer_destroy(ktimer* timer);
+
+//! Advance the timer wheel by one tick, this is
+//!   called by the scheduler on each SysTick interrupt
+void ktimer_tick();
+
+#endif // ALOS_KTIMER_H
@@ -0,0 +1,152 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALOS_KVSYS_H
+#define ALOS_KVSYS_H
+
+#include <stdint.h>
+#include "drivers/dwt.h"
+
+// The vsys block is a small kernel data block that tasks can read
+//   without any system call : it holds the kernel clock base and the
+//   identity of the running task. It is updated by the kernel on each
+//   tick and context switch, under a sequence counter : readers retry
+//   while the counter is odd or changed during their read.
+// Tasks get its address once with the kvsys_get() syscall,
+//   then use the inline readers below.
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! Fixed-point shift of kvsys.ns_mult
+#define KVSYS_NS_SHIFT 24
+
+//! The vsys data block
+struct kvsys
+{
+    //! Sequence counter, odd while an update is in progress
+    volatile uint32_t seq;
+    //! Current task's pid
+    volatile int pid;
+    //! Incremented on each context switch
+    volatile uint32_t generation;
+    //! Cycles to nanoseconds multiplier (KVSYS_NS_SHIFT fixed-point)
+    volatile uint32_t ns_mult;
+    //! Tick count since boot
+    volatile uint64_t ticks;
+    //! Time at the start of the current tick, in ns
+    volatile uint64_t base_ns;
+    //! Cycle counter value at the start of the current tick
+    volatile uint32_t base_cycles;
+};
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+//! Get the vsys block (system call).
+//! \return The vsys block, read-only for tasks
+const struct kvsys* kvsys_get();
+
+//! Publish the kernel clock state, this is called by
+//!   ktime on each tick.
+//! \param ticks The tick count
+//! \param base_ns The time at the start of the tick, in ns
+//! \param base_cycles The cycle counter value at the start of the tick
+//! \param ns_mult Cycles to ns multiplier (KVSYS_NS_SHIFT fixed-point)
+void kvsys_update_time(uint64_t ticks, uint64_t base_ns, uint32_t base_cycles, uint32_t ns_mult);
+
+//! Publish the running task, this is called
+//!   by the scheduler on each context switch.
+//! \param pid The new task's pid
+void kvsys_update_task(int pid);
+
+//! Begin a read of the vsys block
+//! \param vsys The vsys block
+//! \return The sequence value to give back to kvsys_read_retry()
+static inline uint32_t kvsys_read_begin(const struct kvsys* vsys)
+{
+    uint32_t seq;
+
+    while ((seq = vsys->seq) & 1)
+        ;
+
+    asm volatile("dmb" : : : "memory");
+    return seq;
+}
+
+//! End a read of the vsys block
+//! \param vsys The vsys block
+//! \param seq The value returned by kvsys_read_begin()
+//! \return Non-zero if the read data is torn, and must be read again
+static inline int kvsys_read_retry(const struct kvsys* vsys, uint32_t seq)
+{
+    asm volatile("dmb" : : : "memory");
+    return vsys->seq != seq;
+}
+
+//! Get the monotonic time since boot, in nanoseconds,
+//!   consistent with ktime_now()
+//! \param vsys The vsys block
+//! \return The elapsed time in ns
+static inline uint64_t kvsys_now(const struct kvsys* vsys)
+{
+    uint64_t base_ns;
+    uint32_t base_cycles, ns_mult, seq;
+
+    do
+    {
+        seq = kvsys_read_begin(vsys);
+        base_ns = vsys->base_ns;
+        base_cycles = vsys->base_cycles;
+        ns_mult = vsys->ns_mult;
+    } while (kvsys_read_retry(vsys, seq));
+
+    // Both factors are 32-bit wide, so their 64-bit product can't overflow
+    uint32_t elapsed = DWT_CYCCNT - base_cycles;
+    return base_ns + (((uint64_t)elapsed * ns_mult) >> KVSYS_NS_SHIFT);
+}
+
+//! Get the number of ticks elapsed since boot
+//! \param vsys The vsys block
+//! \return The tick count
+static inline uint64_t kvsys_ticks(const struct kvsys* vsys)
+{
+    uint64_t ticks;
+    uint32_t seq;
+
+    do
+    {
+        seq = kvsys_read_begin(vsys);
+        ticks = vsys->ticks;
+    } while (kvsys_read_retry(vsys, seq));
+
+    return ticks;
+}
+
+//! Get the pid of the calling task
+//! \param vsys The vsys block
+//! \return The pid
+static inline int kvsys_getpid(const struct kvsys* vsys)
+{
+    // A single word, and it can only be ours while we run
+    return vsys->pid;
+}
+
+#endif // ALOS_KVSYS_H
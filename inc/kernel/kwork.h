@@ -0,0 +1,59 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALOS_KWORK_H
+#define ALOS_KWORK_H
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! Work queue levels, each one being serviced
+//!   by its own worker thread, with a decreasing
+//!   scheduling priority
+enum
+{
+    //! Urgent deferred work (runs before any regular task)
+    KWORK_HIGH = 0,
+    //! Default level for deferred work
+    KWORK_NORMAL = 1,
+    //! Background work (runs when regular tasks are idle)
+    KWORK_LOW = 2,
+    //! Number of work queue levels
+    KWORK_LEVELS = 3
+};
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+//! Init the work queues and spawn their worker threads.
+//! The scheduler must have been initialized.
+//! \return 0 if OK, -1 otherwise
+int kwork_init();
+
+//! Queue some work to be run later by a worker thread.
+//! This is safe to call from interrupt handlers as
+//!   well as from tasks, and never blocks.
+//! \param level The work queue to use (see KWORK_*)
+//! \param fn The callback to run
+//! \param arg The argument to pass to the callback
+//! \return 0 if OK, -1 if the queue is full or on error
+int kwork_queue(int level, void (*fn)(void*), void* arg);
+
+#endif // ALOS_KWORK_H
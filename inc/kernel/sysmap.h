@@ -22,24 +22,40 @@
 
 #include "kernel/kmalloc.h"
 #include "kernel/kmodule.h"
+#include "kernel/kprog.h"
 #include "kernel/ksched.h"
+#include "kernel/ksysring.h"
+#include "kernel/kvsys.h"
+#include "kernel/ksysmap.h"
 
 #endif // INCLUDES
 
 #ifdef SYSCALLS
 
-// Declare here each system call
+// Declare here each system call, as
+//   DECL_SYSCALL(id, return type, handler, number of arguments, (argument types))
+//   (use (void) as the argument types of a syscall with no arguments)
 // *IMPORTANT* to remain backward-compatible,
 //   always keep the same syscall order,
 //   and append new syscalls to the list.
-// If one was removed, replace its entry by a null
-//   pointer (that will return an error to the task)
-
-DECL_SYSCALL(void*, kmalloc, (int))
-DECL_SYSCALL(void*, krealloc, (void*, int))
-DECL_SYSCALL(void, kfree, (void*))
-DECL_SYSCALL(int, kmodule_insert, (const char*, int))
-DECL_SYSCALL(int, kmodule_remove, (const char*, int))
-DECL_SYSCALL(int, ksched_spawn, (const char*, void*, void*))
+// If one was removed, replace its entry by DECL_NOSYSCALL(id)
+//   (that will return an error to the task)
+// Ids must match the position in the list, and the handler's
+//   prototype must match the declared types : both are checked
+//   at compile time (see ksysmap.c).
+// Syscalls take at most 6 arguments, each fitting in a register.
+
+DECL_SYSCALL(0, void*, kmalloc, 1, (int))
+DECL_SYSCALL(1, void*, krealloc, 2, (void*, int))
+DECL_SYSCALL(2, void, kfree, 1, (void*))
+DECL_SYSCALL(3, kmodule*, kmodule_insert, 2, (const char*, int))
+DECL_SYSCALL(4, int, kmodule_remove, 2, (const char*, int))
+DECL_SYSCALL(5, int, ksched_spawn, 3, (const char*, void*, void*))
+DECL_SYSCALL(6, int, ksched_getpid, 0, (void))
+DECL_SYSCALL(7, int, ksysring_setup, 2, (struct ksysring*, int))
+DECL_SYSCALL(8, int, ksysring_enter, 1, (int))
+DECL_SYSCALL(9, const struct kvsys*, kvsys_get, 0, (void))
+DECL_SYSCALL(10, int, ksysmap_stats, 3, (int, struct ksysmap_stats*, int))
+DECL_SYSCALL(11, int, kprog_spawn, 2, (const char*, void*))
 
 #endif // SYSCALLS
\ No newline at end of file
@@ -0,0 +1,176 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALOS_KSYS_H
+#define ALOS_KSYS_H
+
+// This header generates, from the system call table (kernel/sysmap.h),
+//   a typed stub for each system call : ksys_<handler>(...).
+// Stubs are C99 inline functions, always inlined with GCC. Out-of-line
+//   definitions (for function pointers) are provided by libksys.a.
+// The SVC handler only ever modifies the caller's r0 (see ksyscall.s),
+//   so the stubs don't clobber anything else.
+
+#include <stdint.h>
+
+#define INCLUDES
+#include "kernel/sysmap.h"
+#undef INCLUDES
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+#ifndef KSYS_INLINE
+#define KSYS_INLINE inline __attribute__((always_inline))
+#endif
+
+//! System call ids, as KSYS_<handler>
+enum
+{
+#define SYSCALLS
+#define DECL_SYSCALL(id, rtp, symbol, nargs, args) KSYS_##symbol = (id),
+#define DECL_NOSYSCALL(id)
+#include "kernel/sysmap.h"
+#undef DECL_NOSYSCALL
+#undef DECL_SYSCALL
+#undef SYSCALLS
+};
+
+// Stub generation helpers
+
+#define _KSYS_CAT(a, b) _KSYS_CAT_(a, b)
+#define _KSYS_CAT_(a, b) a##b
+#define _KSYS_UNPACK(...) __VA_ARGS__
+#define _KSYS_STUB(nargs, ...) _KSYS_CAT(_KSYS_STUB, nargs)(__VA_ARGS__)
+
+//! Bind the argument n to its register
+#define _KSYS_REG(n) register uint32_t r##n asm("r" #n) = (uint32_t)a##n
+
+//! Expand to 1 if rtp is exactly void, 0 otherwise (pasting
+//!   void* or other types leaves tokens behind)
+#define _KSYS_ISVOID(rtp) _KSYS_ISEMPTY(_KSYS_CAT(_KSYS_VOID_, rtp))
+#define _KSYS_VOID_void
+#define _KSYS_ISEMPTY(x) _KSYS_CHECK(_KSYS_EMPTY_PROBE x ())
+#define _KSYS_EMPTY_PROBE() ~, 1
+#define _KSYS_CHECK(...) _KSYS_SECOND(__VA_ARGS__, 0, )
+#define _KSYS_SECOND(a, b, ...) b
+
+//! Return the syscall's result, a void stub can't
+//!   return any expression
+#define _KSYS_RETURN(rtp) _KSYS_CAT(_KSYS_RETURN, _KSYS_ISVOID(rtp))(rtp)
+#define _KSYS_RETURN0(rtp) return (rtp)r0
+#define _KSYS_RETURN1(rtp) (void)r0
+
+#define _KSYS_STUB0(id, rtp, symbol, ...)                                \
+    KSYS_INLINE rtp ksys_##symbol(void)                                  \
+    {                                                                    \
+        register uint32_t r0 asm("r0");                                  \
+        asm volatile("svc %[nr]" : "=r"(r0) : [nr] "i"(id) : "memory"); \
+        _KSYS_RETURN(rtp);                                               \
+    }
+
+#define _KSYS_STUB1(id, rtp, symbol, t0)                                 \
+    KSYS_INLINE rtp ksys_##symbol(t0 a0)                                 \
+    {                                                                    \
+        _KSYS_REG(0);                                                    \
+        asm volatile("svc %[nr]" : "+r"(r0) : [nr] "i"(id) : "memory"); \
+        _KSYS_RETURN(rtp);                                               \
+    }
+
+#define _KSYS_STUB2(id, rtp, symbol, t0, t1)                                       \
+    KSYS_INLINE rtp ksys_##symbol(t0 a0, t1 a1)                                    \
+    {                                                                              \
+        _KSYS_REG(0);                                                              \
+        _KSYS_REG(1);                                                              \
+        asm volatile("svc %[nr]" : "+r"(r0) : [nr] "i"(id), "r"(r1) : "memory"); \
+        _KSYS_RETURN(rtp);                                                         \
+    }
+
+#define _KSYS_STUB3(id, rtp, symbol, t0, t1, t2)                                            \
+    KSYS_INLINE rtp ksys_##symbol(t0 a0, t1 a1, t2 a2)                                      \
+    {                                                                                       \
+        _KSYS_REG(0);                                                                       \
+        _KSYS_REG(1);                                                                       \
+        _KSYS_REG(2);                                                                       \
+        asm volatile("svc %[nr]" : "+r"(r0) : [nr] "i"(id), "r"(r1), "r"(r2) : "memory"); \
+        _KSYS_RETURN(rtp);                                                                  \
+    }
+
+#define _KSYS_STUB4(id, rtp, symbol, t0, t1, t2, t3)                                                 \
+    KSYS_INLINE rtp ksys_##symbol(t0 a0, t1 a1, t2 a2, t3 a3)                                        \
+    {                                                                                                \
+        _KSYS_REG(0);                                                                                \
+        _KSYS_REG(1);                                                                                \
+        _KSYS_REG(2);                                                                                \
+        _KSYS_REG(3);                                                                                \
+        asm volatile("svc %[nr]" : "+r"(r0) : [nr] "i"(id), "r"(r1), "r"(r2), "r"(r3) : "memory"); \
+        _KSYS_RETURN(rtp);                                                                           \
+    }
+
+// The 5th and 6th arguments are pushed on top of the stack,
+//   where the SVC handler picks them up
+#define _KSYS_STUB5(id, rtp, symbol, t0, t1, t2, t3, t4)                \
+    KSYS_INLINE rtp ksys_##symbol(t0 a0, t1 a1, t2 a2, t3 a3, t4 a4)    \
+    {                                                                   \
+        _KSYS_REG(0);                                                   \
+        _KSYS_REG(1);                                                   \
+        _KSYS_REG(2);                                                   \
+        _KSYS_REG(3);                                                   \
+        _KSYS_REG(4);                                                   \
+        asm volatile("push {r4, r5}\n\t"                                \
+                     "svc %[nr]\n\t"                                    \
+                     "add sp, #8"                                       \
+                     : "+r"(r0)                                         \
+                     : [nr] "i"(id), "r"(r1), "r"(r2), "r"(r3), "r"(r4) \
+                     : "memory");                                       \
+        _KSYS_RETURN(rtp);                                              \
+    }
+
+#define _KSYS_STUB6(id, rtp, symbol, t0, t1, t2, t3, t4, t5)                     \
+    KSYS_INLINE rtp ksys_##symbol(t0 a0, t1 a1, t2 a2, t3 a3, t4 a4, t5 a5)      \
+    {                                                                            \
+        _KSYS_REG(0);                                                            \
+        _KSYS_REG(1);                                                            \
+        _KSYS_REG(2);                                                            \
+        _KSYS_REG(3);                                                            \
+        _KSYS_REG(4);                                                            \
+        _KSYS_REG(5);                                                            \
+        asm volatile("push {r4, r5}\n\t"                                         \
+                     "svc %[nr]\n\t"                                             \
+                     "add sp, #8"                                                \
+                     : "+r"(r0)                                                  \
+                     : [nr] "i"(id), "r"(r1), "r"(r2), "r"(r3), "r"(r4), "r"(r5) \
+                     : "memory");                                                \
+        _KSYS_RETURN(rtp);                                                       \
+    }
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+// One stub per system call
+#define SYSCALLS
+#define DECL_SYSCALL(id, rtp, symbol, nargs, args) _KSYS_STUB(nargs, id, rtp, symbol, _KSYS_UNPACK args)
+#define DECL_NOSYSCALL(id)
+#include "kernel/sysmap.h"
+#undef DECL_NOSYSCALL
+#undef DECL_SYSCALL
+#undef SYSCALLS
+
+#endif // ALOS_KSYS_H
@@ -0,0 +1,33 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "user/ksys.h"
+
+// This file provides the out-of-line definitions of the system
+//   call stubs declared inline in user/ksys.h, so that libksys.a
+//   can satisfy calls that are not inlined (e.g. through pointers).
+// In C99, an extern declaration of an inline function turns its
+//   definition into an external one.
+
+#define SYSCALLS
+#define DECL_SYSCALL(id, rtp, symbol, nargs, args) extern rtp ksys_##symbol args;
+#define DECL_NOSYSCALL(id)
+#include "kernel/sysmap.h"
+#undef DECL_NOSYSCALL
+#undef DECL_SYSCALL
+#undef SYSCALLS
@@ -15,8 +15,7 @@ DIST_PATH   = $(KERNEL_ROOT)/initrd/modules/
 include module.mk
 
 # Mandatory CC flags
-CC_FLAGS += -std=c11 -fno-common -O0
-CC_FLAGS += -mlong-calls -mword-relocations
+CC_FLAGS += -std=c11 -fno-common -O2
 CC_FLAGS += $(DEFINES) -I$(INC_DIR) -I$(KERNEL_ROOT)/inc
 
 # Format flags
@@ -58,10 +57,29 @@ format: $(C_FMT) $(H_FMT)
 -include $(C_DEP) $(S_DEP)
 
 # Translation
+# The top-level Makefile sets MODPOST so that modules are compacted,
+#   and once the kernel is built, KERNEL_ELF too so that they get
+#   prelinked against it (the output is only replaced when it changed,
+#   not to relink the kernel again), MODPOST_FLAGS is passed
+#   to it when prelinking
+ifneq ($(KERNEL_ELF),)
+$(DIST_FILE): $(MOD_FILE) $(KERNEL_ELF)
+	@echo "(MODPOST) $<"
+	@mkdir -p $(DIST_PATH)
+	@$(MODPOST) $(MODPOST_FLAGS) $(KERNEL_ELF) $< $@.tmp
+	@cmp -s $@.tmp $@ || cp $@.tmp $@
+	@rm -f $@.tmp
+else ifneq ($(MODPOST),)
+$(DIST_FILE): $(MOD_FILE)
+	@echo "(MODPOST) $<"
+	@mkdir -p $(DIST_PATH)
+	@$(MODPOST) -c $< $@
+else
 $(DIST_FILE): $(MOD_FILE)
 	@echo "(MODPOST) $<"
 	@mkdir -p $(DIST_PATH)
 	@cp $< $@
+endif
 
 $(MOD_FILE): $(C_OBJ) $(S_OBJ)
 	@mkdir -p $(@D)
@@ -23,12 +23,21 @@
 #include "kernel/kelf.h"
 #include "kernel/kmodule.h"
 #include "kernel/ksyscall.h"
+#include "kernel/kinit.h"
 
 #include "kernel/fs/inode.h"
 #include "kernel/fs/vfs.h"
 #include "kernel/fs/tarfs.h"
 
 #include "kernel/ksched.h"
+#include "kernel/kwork.h"
+#include "kernel/ktimer.h"
+#include "kernel/ktime.h"
+#include "kernel/ksysring.h"
+#include "kernel/kvsys.h"
+#include "kernel/kcrit.h"
+
+#include "user/ksys.h"
 
 #include <string.h>
 
@@ -51,52 +60,6 @@ void print_initrd(struct inode* node, int indent)
     }
 }
 
-void export_ksymbols()
-{
-    // ksymbols.h exports
-    ksymbol_add("ksymbol_add", &ksymbol_add);
-    ksymbol_add("ksymbol", &ksymbol);
-
-    // kprint.h exports
-    ksymbol_add("kprint", &kprint);
-
-    // kmalloc.h exports
-    ksymbol_add("kmalloc", &kmalloc);
-    ksymbol_add("krealloc", &krealloc);
-    ksymbol_add("kfree", &kfree);
-
-    // kelf.h exports
-    ksymbol_add("kelf_load", &kelf_load);
-    ksymbol_add("kelf_unload", &kelf_unload);
-    ksymbol_add("kelf_symbol", &kelf_symbol);
-
-    // kmodule.h exports
-    ksymbol_add("kmodule_insert", &kmodule_insert);
-    ksymbol_add("kmodule_remove", &kmodule_remove);
-
-    // ksched.h exports
-    ksymbol_add("ksched_task_by_pid", &ksched_task_by_pid);
-    ksymbol_add("ksched_change_policy", &ksched_change_policy);
-    ksymbol_add("ksched_spawn", &ksched_spawn);
-
-    // fs/inode.h exports
-    ksymbol_add("inode_cdable", &inode_cdable);
-    ksymbol_add("inode_find_child", &inode_find_child);
-    ksymbol_add("inode_parent_dir", &inode_parent_dir);
-    ksymbol_add("inode_find", &inode_find);
-
-    // fs/tarfs.h exports
-    ksymbol_add("tarfs_mount", &tarfs_mount);
-
-    // fs/vfs.h exports
-    ksymbol_add("vfs_filename", &vfs_filename);
-    ksymbol_add("vfs_path_clean", &vfs_path_clean);
-    ksymbol_add("vfs_find", &vfs_find);
-    ksymbol_add("vfs_umount", &vfs_umount);
-    ksymbol_add("vfs_mkdir", &vfs_mkdir);
-    ksymbol_add("vfs_rawptr", &vfs_rawptr);
-}
-
 /* TODO list :
  *  - design and implement smart fault handlers
  *  - find some sort of user I/O (better than SWO)
@@ -111,12 +74,6 @@ void export_ksymbols()
  *  - design a proper system call system
  */
 
-int __attribute__((naked)) spawn(const char* name, void* addr, void* arg)
-{
-    asm volatile("svc #0x05");
-    asm volatile("bx lr");
-}
-
 void yolo()
 {
     int d = 123456;
@@ -128,7 +85,28 @@ void yolo()
 
 void thread(void* arg)
 {
-    int pid = spawn("yolo", (void*)yolo, 0);
+    int pid = ksys_ksched_spawn("yolo", (void*)yolo, 0);
+    kprint(KPRINT_MSG "spawned 'yolo' with pid %d\n", pid);
+
+    // Measure the system call round trip
+    uint32_t start = ktime_cycles();
+    for (int i = 0; i < 64; ++i)
+        ksys_ksched_getpid();
+    uint32_t cycles = ktime_cycles() - start;
+    kprint(KPRINT_MSG "syscall round trip: %d cycles\n", (int)(cycles / 64));
+
+    // Same thing, through the vsys block
+    const struct kvsys* vsys = ksys_kvsys_get();
+    start = ktime_cycles();
+    for (int i = 0; i < 64; ++i)
+        kvsys_getpid(vsys);
+    cycles = ktime_cycles() - start;
+    kprint(KPRINT_MSG "vsys pid read: %d cycles\n", (int)(cycles / 64));
+
+#ifdef KCRIT_STATS
+    // Worst interrupt masking time since boot, module loading included
+    kprint(KPRINT_MSG "worst kcrit section: %d cycles\n", (int)kcrit_max_cycles(0));
+#endif
 
     int c = (int)arg + 1;
     for (int i = 0;; ++i)
@@ -137,62 +115,96 @@ void thread(void* arg)
     }
 }
 
-int main()
+//! Boot steps (see boot_steps below)
+enum
 {
-    int err;
-
-    // Init the SWO debug module
-    kprint_init();
-
-    // Init memory allocation
-    err = kmalloc_init();
-    if (err < 0)
-        kprint(KPRINT_ERR "kmalloc_init() failed\n");
-    else
-        kprint(KPRINT_MSG "memory allocator initialized\n");
-
-    // Init system calls
-    ksyscall_init();
-
-    // Export kernel symbols
-    export_ksymbols();
-    kprint(KPRINT_MSG "exported kernel symbols\n");
+    STEP_KMALLOC,
+    STEP_KTIME,
+    STEP_SYSCALL,
+    STEP_SCHED,
+    STEP_KWORK,
+    STEP_KTIMER,
+    STEP_SYSRING,
+    STEP_TASKS,
+    STEP_INITRD,
+    STEP_MODULES,
+    STEP_COUNT
+};
+
+//! Spawn the time-critical tasks
+//! \return 0 if OK, -1 otherwise
+int spawn_tasks()
+{
+    return ksched_spawn("[thread]", (void*)&thread, 0) < 0 ? -1 : 0;
+}
 
+//! Mount the initrd and log its contents
+//! \return 0 if OK, -1 otherwise
+int mount_initrd()
+{
     // Get root inode
     struct inode* root_in = vfs_find("/");
 
     // Mkdir initrd mount point
-    err = vfs_mkdir(root_in, "initrd");
+    int err = vfs_mkdir(root_in, "initrd");
     struct inode* initrd_in = vfs_find("/initrd");
     if (err < 0 || !initrd_in)
+    {
         kprint(KPRINT_ERR "unable to mkdir initrd mount point\n");
-    else
-        kprint(KPRINT_MSG "initrd mount point created\n");
+        return -1;
+    }
 
     // Mount the initrd filesystem
     extern int _ld_initrd_start;
-    err = tarfs_mount(initrd_in, &_ld_initrd_start);
-    if (err < 0)
+    if (tarfs_mount(initrd_in, &_ld_initrd_start) < 0)
+    {
         kprint(KPRINT_ERR "unable to mount initrd\n");
-    else
-        kprint(KPRINT_MSG "initrd mounted\n");
+        return -1;
+    }
 
     // Log its contents
     kprint(KPRINT_TRACE "=== initrd dump ===\n");
     print_initrd(initrd_in, 0);
     kprint(KPRINT_TRACE "===================\n");
 
-    kmodule_insert("sample", 1);
+    return 0;
+}
 
-    err = ksched_init();
-    if (err < 0)
-        kprint(KPRINT_ERR "failed to init the scheduler\n");
-    else
-        kprint(KPRINT_MSG "scheduler succesfully initialized\n");
+//! Load the boot modules (and their dependencies) at once
+//! \return 0 if OK, -1 otherwise
+int load_modules()
+{
+    const char* modules[] = {"sample"};
+
+    return kmodule_insert_set(modules, sizeof(modules) / sizeof(modules[0]));
+}
+
+//! The boot sequence : time-critical tasks are started as soon
+//!   as the scheduler is up, the initrd and modules are loaded
+//!   in the background
+static const struct kinit_step boot_steps[STEP_COUNT] = {
+    [STEP_KMALLOC] = {"memory allocator", &kmalloc_init, 0, 0},
+    [STEP_KTIME] = {"kernel clock", &ktime_init, 0, 0},
+    [STEP_SYSCALL] = {"system calls", &ksyscall_init, 0, 0},
+    [STEP_SCHED] = {"scheduler", &ksched_init, KINIT_DEP(STEP_KMALLOC) | KINIT_DEP(STEP_KTIME), 0},
+    [STEP_KWORK] = {"work queues", &kwork_init, KINIT_DEP(STEP_SCHED), 0},
+    [STEP_KTIMER] = {"timer service", &ktimer_init, KINIT_DEP(STEP_SCHED), 0},
+    [STEP_SYSRING] = {"syscall rings", &ksysring_init, KINIT_DEP(STEP_SCHED) | KINIT_DEP(STEP_KTIMER) | KINIT_DEP(STEP_KWORK), 0},
+    [STEP_TASKS] = {"critical tasks", &spawn_tasks, KINIT_DEP(STEP_SCHED) | KINIT_DEP(STEP_SYSCALL), 0},
+    [STEP_INITRD] = {"initrd", &mount_initrd, KINIT_DEP(STEP_KMALLOC), 1},
+    [STEP_MODULES] = {"boot modules", &load_modules, KINIT_DEP(STEP_INITRD) | KINIT_DEP(STEP_SCHED), 1},
+};
+
+int main()
+{
+    // Init the SWO debug module
+    kprint_init();
+
+    if (kinit_run(boot_steps, STEP_COUNT) < 0)
+        kprint(KPRINT_ERR "some boot steps failed\n");
 
-    err = ksched_spawn("[thread]", (void*)&thread, 0);
-    if (err < 0)
-        kprint(KPRINT_ERR "failed to spawn the first task =(\n");
+    ksched_start();
+    kprint(KPRINT_ERR "failed to start the scheduler\n");
 
     /*kmodule_remove("sample", 0);
 
@@ -0,0 +1,31 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "platform.h"
+#include "drivers/dwt.h"
+
+//! DWT control register
+#define DWT_CTRL (*(volatile uint32_t*)0xE0001000)
+
+void dwt_init()
+{
+    CoreDebug->DEMCR |= (0x01 << 24); // TRCENA = 1
+
+    DWT_CYCCNT = 0;            // clear the cycle counter
+    DWT_CTRL |= (0x01 << 0);   // CYCCNTENA = 1 (cycle counter enabled)
+}
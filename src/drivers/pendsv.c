@@ -18,10 +18,11 @@
 
 #include "platform.h"
 #include "drivers/pendsv.h"
+#include "drivers/irqprio.h"
 
 void pendsv_init()
 {
-    SCB->SHP[10] = 14 << 4; // PRI_14 = 15
+    SCB->SHP[10] = IRQPRIO(IRQPRIO_PENDSV);
 }
 
 void pendsv_trigger()
@@ -18,8 +18,9 @@
 
 #include "platform.h"
 #include "drivers/svcall.h"
+#include "drivers/irqprio.h"
 
 void svcall_init()
 {
-    SCB->SHP[7] = 13 << 4; // PRI_11 = 14
+    SCB->SHP[7] = IRQPRIO(IRQPRIO_SVCALL);
 }
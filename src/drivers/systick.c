@@ -18,17 +18,17 @@
 
 #include "platform.h"
 #include "drivers/systick.h"
+#include "drivers/irqprio.h"
 
-void systick_init()
+void systick_init(uint32_t reload)
 {
-    SysTick->LOAD = 0x00014820;    // interrupt every 500 us (AHB prescaler is 1 so
-                                   // its clock is 168 MHz)
+    SysTick->LOAD = reload;        // interrupt every reload + 1 processor clock cycles
     SysTick->VAL = 0x00000000;     // clear current value
     SysTick->CTRL |= (0x01 << 2);  // CLKSOURCE = 1 (processor clock select)
     SysTick->CTRL |= (0x01 << 1);  // TICKINT = 1 (interrupt enabled)
     SysTick->CTRL &= ~(0x01 << 0); // ENABLE = 0 (disabled)
 
-    SCB->SHP[11] = 15 << 0x04; // PRI_15 = 16, minimal priority
+    SCB->SHP[11] = IRQPRIO(IRQPRIO_SYSTICK); // just above PendSV
 }
 
 void systick_start()
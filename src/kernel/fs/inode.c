@@ -17,6 +17,7 @@
  */
 
 #include "kernel/fs/inode.h"
+#include "kernel/ksymbols.h"
 #include "kernel/fs/vfs.h"
 #include "kernel/kmalloc.h"
 #include <string.h>
@@ -142,4 +143,13 @@ struct inode* inode_find(struct inode* root, const char* path)
         return 0;
 
     return inode_find_child(head, vfs_filename(path));
-}
\ No newline at end of file
+}
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(inode_cdable);
+EXPORT_KSYMBOL(inode_find_child);
+EXPORT_KSYMBOL(inode_parent_dir);
+EXPORT_KSYMBOL(inode_find);
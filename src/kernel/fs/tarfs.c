@@ -17,6 +17,7 @@
  */
 
 #include "kernel/fs/inode.h"
+#include "kernel/ksymbols.h"
 #include "kernel/fs/vfs.h"
 #include "kernel/kmalloc.h"
 #include <string.h>
@@ -202,6 +203,31 @@ static int o_rawptr(struct inode* node, void** ptr, int* size)
     return 0;
 }
 
+//! Read from a file
+//! \param node The inode
+//! \param offset Offset in the file to read from
+//! \param buf The buffer to read into
+//! \param size Number of bytes to read
+//! \return The number of bytes read, -1 upon failure
+static int o_read(struct inode* node, int offset, void* buf, int size)
+{
+    if (!node || node->tag != I_FILE || !buf)
+        return -1;
+
+    struct file_data* file = (struct file_data*)node->file.fs_data;
+    if (!file)
+        return -1;
+
+    if (offset >= file->size)
+        return 0;
+    if (size > file->size - offset)
+        size = file->size - offset;
+
+    memcpy(buf, file->data + offset, size);
+
+    return size;
+}
+
 /////////////////////////////
 //// Public module's API ////
 /////////////////////////////
@@ -219,6 +245,7 @@ int tarfs_mount(struct inode* root, void* tarblob)
     super->umount = &o_umount;
     super->mkdir = 0;
     super->rawptr = &o_rawptr;
+    super->read = &o_read;
 
     root->superblock = super;
 
@@ -312,3 +339,9 @@ int tarfs_mount(struct inode* root, void* tarblob)
 
     return 0;
 }
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(tarfs_mount);
@@ -17,6 +17,7 @@
  */
 
 #include "kernel/fs/vfs.h"
+#include "kernel/ksymbols.h"
 #include "kernel/kmalloc.h"
 #include <string.h>
 
@@ -55,7 +56,8 @@ static struct superblock _superblock = {
     0,
     &o_umount,
     &o_mkdir,
-    0 // rawptr
+    0, // rawptr
+    0  // read
 };
 static struct superblock* superblock = &_superblock;
 
@@ -230,3 +232,26 @@ int vfs_rawptr(struct inode* node, void** ptr, int* size)
 
     return node->superblock->rawptr(node, ptr, size);
 }
+
+int vfs_read(struct inode* node, int offset, void* buf, int size)
+{
+    if (!node || !buf || offset < 0 || size < 0 || !node->superblock)
+        return -1;
+
+    if (!node->superblock->read)
+        return -1;
+
+    return node->superblock->read(node, offset, buf, size);
+}
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(vfs_filename);
+EXPORT_KSYMBOL(vfs_path_clean);
+EXPORT_KSYMBOL(vfs_find);
+EXPORT_KSYMBOL(vfs_umount);
+EXPORT_KSYMBOL(vfs_mkdir);
+EXPORT_KSYMBOL(vfs_rawptr);
+EXPORT_KSYMBOL(vfs_read);
@@ -0,0 +1,68 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "kernel/kcrit.h"
+#include "kernel/ksymbols.h"
+
+/////////////////////////////////////
+//// Module's internal variables ////
+/////////////////////////////////////
+
+#ifdef KCRIT_STATS
+//! Cycle count at the start of the current outermost
+//!   critical section
+uint32_t kcrit_stats_start = 0;
+
+//! Longest critical section seen so far (in cycles)
+static uint32_t max_cycles = 0;
+#endif
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+#ifdef KCRIT_STATS
+void kcrit_stats_stop()
+{
+    uint32_t cycles = DWT_CYCCNT - kcrit_stats_start;
+    if (cycles > max_cycles)
+        max_cycles = cycles;
+}
+#endif
+
+uint32_t kcrit_max_cycles(int reset)
+{
+#ifdef KCRIT_STATS
+    uint32_t crit = kcrit_enter();
+    uint32_t cycles = max_cycles;
+    if (reset)
+        max_cycles = 0;
+    kcrit_exit(crit);
+
+    return cycles;
+#else
+    (void)reset;
+    return 0;
+#endif
+}
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(kcrit_max_cycles);
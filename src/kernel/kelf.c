@@ -18,15 +18,19 @@
 
 #include "kernel/kelf.h"
 #include "kernel/elf32.h"
+#include "kernel/kmodimg.h"
 #include "kernel/kmalloc.h"
 #include "kernel/ksymbols.h"
+#include "kernel/kprint.h"
+#include "kernel/ksched.h"
 #include <string.h>
 
 ///////////////////////////
 //// Module parameters ////
 ///////////////////////////
 
-// N/A
+//! Number of relocations read at once when streaming an elf
+#define RELS_CHUNK 32
 
 ////////////////////////////////
 //// Module's sanity checks ////
@@ -38,18 +42,58 @@
 //// Module's definitions ////
 //////////////////////////////
 
+//! progmem_shoff value for sections left in place in the blob
+#define IN_PLACE ((elf32_off)-1)
+
+//! Size in words of a branch veneer, and of a lazy stub
+#define VENEER_WORDS 2
+#define LAZY_STUB_WORDS 6
+
+//! Index of the target's address in both veneers and lazy stubs
+#define VENEER_TARGET 1
+//! Index of the symbol's name in a lazy stub
+#define LAZY_STUB_NAME 5
+
+//! An exported symbol, as kept by kelf_finalize()
+struct kelf_export
+{
+    //! The symbol's name
+    const char* name;
+    //! The symbol's address
+    void* addr;
+};
+
 //! An ELF32 binary blob representation
 //!   for the kernel.
 struct kelf
 {
-    union
-    {
-        //! A raw pointer to the beginning of
-        //!   the elf blob
-        void* raw;
-        //! A pointer to the header of the elf blob
-        elf32_header* header;
-    };
+    //! A raw pointer to the beginning of the elf
+    //!   blob, 0 when streaming it
+    void* raw;
+    //! Where the elf is read from when streaming it
+    //!   (see kelf_load_stream(), read is 0 otherwise)
+    struct kelf_reader reader;
+
+    //! Load flags (see KELF_F_*)
+    int flags;
+
+    //! The elf header, section header table, symbol table,
+    //!   and string tables. They point into the blob, or to
+    //!   copies when streaming.
+    elf32_header* header;
+    char* shtab;
+    char* shstrdata;
+    char* symdata;
+    char* symstrdata;
+    //! Buffer for relocations, when streaming
+    elf32_rel* relbuf;
+    //! Fixup stream and symbol tables of a prelinked image
+    //!   (see image_parts()), in the blob or a copy
+    char* imgtail;
+
+    //! Header of the blob if it is a prelinked module
+    //!   image (see kmodimg.h), 0 for ELF blobs
+    struct kmodimg_header* image;
 
     //! The section header string table header
     elf32_shdr* shstrtab;
@@ -69,47 +113,115 @@ struct kelf
     //!   memory image
     elf32_off* progmem_shoff;
 
+    //! Address of each section in the program's memory
+    //!   image, indexed by section header index (0 for
+    //!   sections that are not loaded)
+    elf32_addr* shaddr;
+
+    //! Hash index of the defined global symbols (open addressing,
+    //!   holds symbol indexes, 0 for empty slots)
+    elf32_half* symhash;
+    //! Size of the above table minus one (it is a power of 2)
+    elf32_word symhash_mask;
+    //! Precomputed SysV hash section, if the blob has one
+    elf32_word* sysvhash;
+
     //! Size in bytes of the program memory image
     elf32_word progmem_size;
     //! Program's memory image
     char* progmem;
 
-    //! Two-dimensional array representing the relocation
-    //!   statuses (1 if satisfied, 0 otherwise). First dimension
-    //!   is the section (in order), second is relocation id.
-    int** rels_statuses;
-    //! Size of the above array
-    int rels_statuses_size;
+    //! Number of relocations applying to the program image,
+    //!   numbered in order across all relocation sections
+    elf32_word rels_count;
+    //! Number of relocations not applied yet
+    elf32_word rels_left;
+    //! Bitset of the relocations not applied yet (bit set
+    //!   for pending relocations)
+    elf32_word* rels_pending;
+    //! Original contents of the words patched by relocations,
+    //!   only kept if some sections are left in place
+    elf32_word* rels_orig;
+
+    //! Veneer of each symbol, by symbol index (the veneer's
+    //!   index plus one, 0 for none), only kept while loading
+    elf32_half* veneer_of;
+    //! Number of veneers
+    elf32_word veneernum;
+    //! Branch veneers for out of range calls (lazy stubs
+    //!   with KELF_F_LAZY)
+    elf32_word* veneers;
     //! Set to 1 if not all relocations are satisfied
     int needs_fix;
+
+    //! Snapshot of the exported symbols, once finalized (the
+    //!   names are stored right after the array, in the same block)
+    struct kelf_export* exports;
+    //! Size of the above array
+    elf32_word nexports;
 };
 
 ///////////////////////////////////////
 //// Module's forward declarations ////
 ///////////////////////////////////////
 
+static int streamed(struct kelf* elf);
+static void* fetch(struct kelf* elf, elf32_off offset, elf32_word size);
+static void release(struct kelf* elf, void* ptr);
+static int fetch_tables(struct kelf* elf);
+static void release_tables(struct kelf* elf);
+static elf32_rel* rels_chunk(struct kelf* elf, elf32_shdr* shdr, elf32_word first, elf32_word* count);
 static int header_check(struct kelf* elf);
 static int find_shstrtab(struct kelf* elf);
 static int find_symtab(struct kelf* elf);
 static int find_symstrtab(struct kelf* elf);
 static int find_allocsh(struct kelf* elf);
+static elf32_word hash_name(const char* name);
+static int exported(elf32_sym* sym);
+static elf32_word first_global(struct kelf* elf);
+static int build_symhash(struct kelf* elf);
+static elf32_sym* find_symbol(struct kelf* elf, const char* name);
 static elf32_shdr* section(struct kelf* elf, elf32_word id);
 static const char* section_name(struct kelf* elf, elf32_shdr* shdr);
 static elf32_sym* symbol(struct kelf* elf, elf32_word id);
 static const char* symbol_name(struct kelf* elf, elf32_sym* sym);
+static int in_place(struct kelf* elf, elf32_shdr* shdr);
 static int alloc_progmem(struct kelf* elf);
 static int load_progmem_section(struct kelf* elf, elf32_word id);
 static int load_progmem(struct kelf* elf);
 static elf32_addr symbol_addr(struct kelf* elf, elf32_sym* sym);
-static int alloc_rels_statuses(struct kelf* elf);
-static int free_rels_statuses(struct kelf* elf);
-static int* rel_status(struct kelf* elf, int sid, int rid);
-static int do_rel_for_section(struct kelf* elf, elf32_shdr* shdr, elf32_rel* rel);
-static int do_rels_for_section(struct kelf* elf, elf32_shdr* shdr, int sid);
+static int loaded_rels(struct kelf* elf, elf32_shdr* shdr);
+static int alloc_pending(struct kelf* elf);
+static int alloc_rels(struct kelf* elf);
+static void free_rels(struct kelf* elf);
+static int needs_veneer(struct kelf* elf, elf32_rel* rel);
+static int alloc_veneers(struct kelf* elf);
+static elf32_word veneer_words(struct kelf* elf);
+static elf32_word* find_veneer(struct kelf* elf, elf32_word r_sym);
+static elf32_word rel_size(elf32_word r_type);
+static int rel_thm_branch(elf32_half* P, elf32_addr S);
+static int rel_thm_short_branch(elf32_half* P, elf32_addr S, int bits);
+static elf32_word thm_mov_get(elf32_half* P);
+static void thm_mov_set(elf32_half* P, elf32_word value);
+static void rel_thm_mov(elf32_half* P, elf32_word value, int upper);
+static int do_rel(struct kelf* elf, elf32_addr base, elf32_rel* rel, elf32_word* orig);
 static int do_rels(struct kelf* elf);
+static void restore_in_place(struct kelf* elf);
+static const char* image_parts(struct kelf* elf, const uint8_t** fixups,
+                               struct kmodimg_symbol** imports, struct kmodimg_symbol** exports);
+static elf32_word read_uleb(const uint8_t** p, const uint8_t* end);
+static int load_image(struct kelf* elf);
+static int do_imports(struct kelf* elf);
+static void* image_symbol(struct kelf* elf, const char* name);
+static int has_in_place(struct kelf* elf);
+static int snapshot_exports(struct kelf* elf);
 static int load(struct kelf* elf);
 static int unload(struct kelf* elf);
 
+// Called from / defined in kelf_lazy.s
+elf32_addr kelf_lazy_bind(elf32_word* stub);
+void kelf_lazy_resolve();
+
 /////////////////////////////////////
 //// Module's internal variables ////
 /////////////////////////////////////
@@ -120,6 +232,133 @@ static int unload(struct kelf* elf);
 //// Module's internal functions ////
 /////////////////////////////////////
 
+//! Check if an elf is streamed, rather than in memory
+//! \param elf The elf to check
+//! \return 1 if so, 0 otherwise
+static int streamed(struct kelf* elf)
+{
+    return elf->reader.read != 0;
+}
+
+//! Get a part of the elf file : a pointer in the blob, or
+//!   a copy read from the reader when streaming
+//! \param elf The elf to work on
+//! \param offset Offset of the part in the file
+//! \param size Size of the part
+//! \return The part's address, 0 upon failure
+static void* fetch(struct kelf* elf, elf32_off offset, elf32_word size)
+{
+    if (!streamed(elf))
+        return elf->raw + offset;
+
+    void* ptr = kmalloc(size ? size : 1);
+    if (!ptr)
+        return 0;
+
+    if (elf->reader.read(elf->reader.ctx, offset, ptr, size) < 0)
+    {
+        kfree(ptr);
+        return 0;
+    }
+
+    return ptr;
+}
+
+//! Release a part obtained with fetch()
+//! \param elf The elf to work on
+//! \param ptr The part's address
+static void release(struct kelf* elf, void* ptr)
+{
+    if (streamed(elf))
+        kfree(ptr);
+}
+
+//! Get the tables needed for linking : section names,
+//!   symbols and their names
+//! \param elf The elf to work on
+//! \return 0 on success, -1 otherwise
+static int fetch_tables(struct kelf* elf)
+{
+    elf->shstrdata = fetch(elf, elf->shstrtab->sh_offset, elf->shstrtab->sh_size);
+    if (!elf->shstrdata)
+        return -1;
+
+    elf->symdata = fetch(elf, elf->symtab->sh_offset, elf->symtab->sh_size);
+    if (!elf->symdata)
+        return -1;
+
+    // Modposted modules have a single string table
+    if (elf->symstrtab == elf->shstrtab)
+        elf->symstrdata = elf->shstrdata;
+    else
+        elf->symstrdata = fetch(elf, elf->symstrtab->sh_offset, elf->symstrtab->sh_size);
+    if (!elf->symstrdata)
+        return -1;
+
+    if (streamed(elf))
+    {
+        elf->relbuf = kmalloc(RELS_CHUNK * sizeof(elf32_rel));
+        if (!elf->relbuf)
+            return -1;
+    }
+
+    return 0;
+}
+
+//! Release the tables, and the copies made when streaming
+//! \param elf The elf to work on
+static void release_tables(struct kelf* elf)
+{
+    if (streamed(elf))
+        kfree(elf->relbuf);
+
+    // (prelinked images share the header's storage)
+    if (elf->symstrdata != elf->shstrdata)
+        release(elf, elf->symstrdata);
+    release(elf, elf->symdata);
+    release(elf, elf->shstrdata);
+    release(elf, elf->shtab);
+    release(elf, elf->header);
+    release(elf, elf->imgtail);
+
+    elf->header = 0;
+    elf->shtab = 0;
+    elf->shstrdata = 0;
+    elf->symdata = 0;
+    elf->symstrdata = 0;
+    elf->relbuf = 0;
+    elf->imgtail = 0;
+    elf->image = 0;
+    elf->shstrtab = 0;
+    elf->symtab = 0;
+    elf->symstrtab = 0;
+}
+
+//! Get a chunk of the relocations of a section
+//! \param elf The elf to work on
+//! \param shdr The relocation section's header
+//! \param first Index of the first relocation to get
+//! \param count Where to store the number of relocations
+//!        in the chunk
+//! \return The chunk, 0 upon failure
+static elf32_rel* rels_chunk(struct kelf* elf, elf32_shdr* shdr, elf32_word first, elf32_word* count)
+{
+    elf32_word nrels = shdr->sh_size / sizeof(elf32_rel);
+    elf32_off offset = shdr->sh_offset + first * sizeof(elf32_rel);
+
+    if (!streamed(elf))
+    {
+        *count = nrels - first;
+        return (elf32_rel*)(elf->raw + offset);
+    }
+
+    *count = nrels - first < RELS_CHUNK ? nrels - first : RELS_CHUNK;
+    if (elf->reader.read(elf->reader.ctx, offset, elf->relbuf, *count * sizeof(elf32_rel)) < 0)
+        return 0;
+
+    return elf->relbuf;
+}
+
 //! Check the header of an elf binary blob.
 //! \param elf The elf blob to check
 //! \return 0 if header is correct, -1 otherwise
@@ -255,6 +494,161 @@ static int find_allocsh(struct kelf* elf)
     return elf->allocshnum;
 }
 
+//! Standard SysV ELF hash function
+//! \param name The string to hash
+//! \return The hash value
+static elf32_word hash_name(const char* name)
+{
+    elf32_word h = 0;
+
+    for (const unsigned char* c = (const unsigned char*)name; *c; ++c)
+    {
+        h = (h << 4) + *c;
+        elf32_word g = h & 0xf0000000;
+        if (g)
+            h ^= g >> 24;
+        h &= ~g;
+    }
+
+    return h;
+}
+
+//! Check if a symbol can be looked up by name
+//!   (it is defined, named and global)
+//! \param sym The symbol to check
+//! \return 1 if so, 0 otherwise
+static int exported(elf32_sym* sym)
+{
+    elf32_word st_bind = ELF32_ST_BIND(sym->st_info);
+
+    if (st_bind != STB_GLOBAL && st_bind != STB_WEAK)
+        return 0;
+
+    return sym->st_name && sym->st_shndx != SHN_UNDEF;
+}
+
+//! Get the index of the first global symbol, those before
+//!   it are local and can't be looked up by name (modposted
+//!   modules keep very few of them)
+//! \param elf The elf blob to work on
+//! \return The index of the first global symbol
+static elf32_word first_global(struct kelf* elf)
+{
+    elf32_word nsyms = elf->symtab->sh_size / elf->symtab->sh_entsize;
+    elf32_word first = elf->symtab->sh_info;
+
+    return (first && first <= nsyms) ? first : 1;
+}
+
+//! Index the defined global symbols by name, or use
+//!   the blob's own SysV hash section if present
+//! \param elf The elf blob to work on
+//! \return 0 on success, -1 otherwise
+static int build_symhash(struct kelf* elf)
+{
+    if (!elf || !elf->symtab)
+        return -1;
+
+    // Look for a precomputed hash of our symbol table
+    for (elf32_word i = 0; i < elf->header->e_shnum && !streamed(elf); ++i)
+    {
+        elf32_shdr* shdr = section(elf, i);
+        if (shdr->sh_type == SHT_HASH && section(elf, shdr->sh_link) == elf->symtab)
+        {
+            elf->sysvhash = (elf32_word*)(elf->raw + shdr->sh_offset);
+            return 0;
+        }
+    }
+
+    elf32_word nsyms = elf->symtab->sh_size / elf->symtab->sh_entsize;
+
+    // Indexes are stored as half-words
+    if (nsyms > 0xFFFF)
+        return -1;
+
+    elf32_word count = 0;
+    for (elf32_word i = first_global(elf); i < nsyms; ++i)
+    {
+        if (exported(symbol(elf, i)))
+            ++count;
+    }
+
+    // Keep the load factor at or below 1/2
+    elf32_word size = 2;
+    while (size < 2 * count)
+        size <<= 1;
+
+    elf->symhash = kmalloc(size * sizeof(elf32_half));
+    if (!elf->symhash)
+        return -1;
+    elf->symhash_mask = size - 1;
+
+    for (elf32_word i = 0; i < size; ++i)
+        elf->symhash[i] = 0;
+
+    for (elf32_word i = first_global(elf); i < nsyms; ++i)
+    {
+        elf32_sym* sym = symbol(elf, i);
+        if (!exported(sym))
+            continue;
+
+        const char* name = symbol_name(elf, sym);
+        if (!name)
+            return -1;
+
+        // Linear probing
+        elf32_word slot = hash_name(name) & elf->symhash_mask;
+        while (elf->symhash[slot])
+            slot = (slot + 1) & elf->symhash_mask;
+
+        elf->symhash[slot] = i;
+    }
+
+    return 0;
+}
+
+//! Find a defined global symbol by name
+//! \param elf The elf blob to work on
+//! \param name The symbol's name
+//! \return The symbol, 0 if not found
+static elf32_sym* find_symbol(struct kelf* elf, const char* name)
+{
+    elf32_word h = hash_name(name);
+
+    // SysV hash section : nbucket, nchain, buckets, chains
+    if (elf->sysvhash)
+    {
+        elf32_word nbucket = elf->sysvhash[0];
+        elf32_word* bucket = elf->sysvhash + 2;
+        elf32_word* chain = bucket + nbucket;
+
+        for (elf32_word i = bucket[h % nbucket]; i != STN_UNDEF; i = chain[i])
+        {
+            elf32_sym* sym = symbol(elf, i);
+            if (!exported(sym))
+                continue;
+
+            const char* sym_name = symbol_name(elf, sym);
+            if (sym_name && strcmp(sym_name, name) == 0)
+                return sym;
+        }
+
+        return 0;
+    }
+
+    if (!elf->symhash)
+        return 0;
+
+    for (elf32_word slot = h & elf->symhash_mask; elf->symhash[slot]; slot = (slot + 1) & elf->symhash_mask)
+    {
+        elf32_sym* sym = symbol(elf, elf->symhash[slot]);
+        if (strcmp(symbol_name(elf, sym), name) == 0)
+            return sym;
+    }
+
+    return 0;
+}
+
 //! Get the id-th section header.
 //! \param elf The elf blob to work on
 //! \param id The identifier of the section header to retrieve
@@ -264,8 +658,7 @@ static elf32_shdr* section(struct kelf* elf, elf32_word id)
     if (!elf || id >= elf->header->e_shnum)
         return 0;
 
-    void* shbase = elf->raw + elf->header->e_shoff;
-    void* section = shbase + id * elf->header->e_shentsize;
+    void* section = elf->shtab + id * elf->header->e_shentsize;
 
     return (elf32_shdr*)section;
 }
@@ -276,10 +669,10 @@ static elf32_shdr* section(struct kelf* elf, elf32_word id)
 //! \return The address of the string, 0 upon failure
 static const char* section_name(struct kelf* elf, elf32_shdr* shdr)
 {
-    if (!elf || !elf->shstrtab)
+    if (!elf || !elf->shstrdata)
         return 0;
 
-    return (const char*)(elf->raw + elf->shstrtab->sh_offset + shdr->sh_name);
+    return (const char*)(elf->shstrdata + shdr->sh_name);
 }
 
 //! Get a symbol entry from the symbol table.
@@ -288,10 +681,10 @@ static const char* section_name(struct kelf* elf, elf32_shdr* shdr)
 //! \return A pointer to the symbol, 0 upon failure
 static elf32_sym* symbol(struct kelf* elf, elf32_word id)
 {
-    if (!elf || !elf->symtab)
+    if (!elf || !elf->symdata)
         return 0;
 
-    return (elf32_sym*)(elf->raw + elf->symtab->sh_offset + id * elf->symtab->sh_entsize);
+    return (elf32_sym*)(elf->symdata + id * elf->symtab->sh_entsize);
 }
 
 //! Get a symbol's name.
@@ -300,7 +693,7 @@ static elf32_sym* symbol(struct kelf* elf, elf32_word id)
 //! \return The symbol's name, 0 if error(s) occured
 static const char* symbol_name(struct kelf* elf, elf32_sym* sym)
 {
-    if (!elf || !sym || !elf->symstrtab)
+    if (!elf || !sym || !elf->symstrdata)
         return 0;
 
     elf32_word st_type = ELF32_ST_TYPE(sym->st_info);
@@ -315,12 +708,33 @@ static const char* symbol_name(struct kelf* elf, elf32_sym* sym)
         if (sym->st_name > elf->symstrtab->sh_size)
             return 0;
 
-        return (const char*)(elf->raw + elf->symstrtab->sh_offset + sym->st_name);
+        return (const char*)(elf->symstrdata + sym->st_name);
     }
 
     return 0;
 }
 
+//! Check if a section can be executed in place, i.e left
+//!   in the blob instead of being copied in program memory
+//! \param elf The elf blob to work on
+//! \param shdr The section's header
+//! \return 1 if so, 0 otherwise
+static int in_place(struct kelf* elf, elf32_shdr* shdr)
+{
+    if (!(elf->flags & KELF_F_XIP) || streamed(elf))
+        return 0;
+
+    // Only read-only sections with contents
+    if ((shdr->sh_flags & SHF_WRITE) || shdr->sh_type != SHT_PROGBITS)
+        return 0;
+
+    // The blob itself must honour the alignment
+    elf32_word align = shdr->sh_addralign;
+    elf32_addr addr = (elf32_addr)(elf->raw + shdr->sh_offset);
+
+    return !align || (addr % align) == 0;
+}
+
 //! Allocate memory for the program's memory image, and
 //!   compute the loaded sections' offsets
 //! \param elf The elf blob to work on
@@ -343,6 +757,14 @@ static int alloc_progmem(struct kelf* elf)
         elf32_shdr* shdr = section(elf, elf->allocsh[i]);
         if (!shdr)
             return -1;
+
+        // This one won't take any program memory
+        if (in_place(elf, shdr))
+        {
+            elf->progmem_shoff[i] = IN_PLACE;
+            continue;
+        }
+
         elf32_word align = shdr->sh_addralign;
 
         // If the required alignment is not even
@@ -350,6 +772,11 @@ static int alloc_progmem(struct kelf* elf)
         if (align > KMALLOC_ALIGNMENT)
             return -1;
 
+        // Word-align every section so that they are loaded
+        //   with word copies
+        if (align < sizeof(elf32_word) && sizeof(elf32_word) <= KMALLOC_ALIGNMENT)
+            align = sizeof(elf32_word);
+
         // Properly align initial address (we know 0 offset
         //   is already aligned by kmalloc)
         elf32_off r = align ? off % align : 0;
@@ -366,11 +793,30 @@ static int alloc_progmem(struct kelf* elf)
     }
 
     // Allocate the required amout of program memory
+    //   (at least one byte, even if all sections are in place)
     elf->progmem_size = off;
-    elf->progmem = kmalloc(elf->progmem_size);
+    elf->progmem = kmalloc(elf->progmem_size ? elf->progmem_size : 1);
     if (!elf->progmem)
         return -1;
 
+    // Build the section index to address table
+    elf->shaddr = kmalloc(elf->header->e_shnum * sizeof(elf32_addr));
+    if (!elf->shaddr)
+        return -1;
+
+    for (elf32_word i = 0; i < elf->header->e_shnum; ++i)
+        elf->shaddr[i] = 0;
+
+    for (elf32_word i = 0; i < elf->allocshnum; ++i)
+    {
+        elf32_word id = elf->allocsh[i];
+
+        if (elf->progmem_shoff[i] == IN_PLACE)
+            elf->shaddr[id] = (elf32_addr)(elf->raw + section(elf, id)->sh_offset);
+        else
+            elf->shaddr[id] = ((elf32_addr)elf->progmem) + elf->progmem_shoff[i];
+    }
+
     return 0;
 }
 
@@ -389,25 +835,47 @@ static int load_progmem_section(struct kelf* elf, elf32_word id)
         return -1;
     elf32_off off = elf->progmem_shoff[id];
 
+    // Executed in place, nothing to load
+    if (off == IN_PLACE)
+        return 0;
+
     // Usually this will be the .bss section, those
     //   are meant to be initialized with zeroes
     if (shdr->sh_type == SHT_NOBITS)
     {
-        for (elf32_off i = 0; i < shdr->sh_size; ++i)
-        {
-            elf->progmem[off + i] = 0;
-        }
+        memset(elf->progmem + off, 0, shdr->sh_size);
+    }
+    // When streaming, read the section straight in place
+    else if (streamed(elf))
+    {
+        if (elf->reader.read(elf->reader.ctx, shdr->sh_offset, elf->progmem + off, shdr->sh_size) < 0)
+            return -1;
     }
-    // Those are .text, .data and .rodata sections
-    // Here we don't mind about read-only sections
-    else if (shdr->sh_type == SHT_PROGBITS)
+    // Those are .text, .data and .rodata sections (and unwind
+    //   tables). Here we don't mind about read-only sections
+    else if (shdr->sh_type == SHT_PROGBITS || shdr->sh_type == SHT_ARM_EXIDX)
     {
         char* sdata = (char*)(elf->raw + shdr->sh_offset);
+        char* pdata = elf->progmem + off;
+        elf32_word size = shdr->sh_size;
 
-        for (elf32_off i = 0; i < shdr->sh_size; ++i)
+        // Destination is word-aligned (see alloc_progmem()), copy
+        //   whole words if the blob is too
+        if (((elf32_addr)sdata % sizeof(elf32_word)) == 0)
         {
-            elf->progmem[off + i] = sdata[i];
+            elf32_word* src = (elf32_word*)sdata;
+            elf32_word* dst = (elf32_word*)pdata;
+
+            for (elf32_word i = 0; i < size / sizeof(elf32_word); ++i)
+                dst[i] = src[i];
+
+            sdata += size & ~(sizeof(elf32_word) - 1);
+            pdata += size & ~(sizeof(elf32_word) - 1);
+            size %= sizeof(elf32_word);
         }
+
+        for (elf32_word i = 0; i < size; ++i)
+            pdata[i] = sdata[i];
     }
     // Those should not be here !
     else
@@ -449,14 +917,11 @@ static elf32_addr symbol_addr(struct kelf* elf, elf32_sym* sym)
 
     // Get the symbol's section address
     elf32_addr st_shaddr = 0x00;
-    for (elf32_word i = 0; i < elf->allocshnum; ++i)
-    {
-        if (elf->allocsh[i] == sym->st_shndx)
-            st_shaddr = ((elf32_addr)elf->progmem) + elf->progmem_shoff[i];
-    }
+    if (sym->st_shndx < elf->header->e_shnum)
+        st_shaddr = elf->shaddr[sym->st_shndx];
 
     // S = symbol value
-    elf32_addr S;
+    elf32_addr S = 0;
 
     // For data or code symbols, S = section offset + value
     if (st_type == STT_OBJECT || st_type == STT_FUNC)
@@ -474,6 +939,12 @@ static elf32_addr symbol_addr(struct kelf* elf, elf32_sym* sym)
 
         S = st_shaddr & ~0x01;
     }
+    // Untyped symbols defined by the module itself (assembly
+    //   labels, ...), S = section offset + value
+    else if (st_type == STT_NOTYPE && st_shaddr)
+    {
+        S = st_shaddr + sym->st_value;
+    }
     // For other symbols (externs, ...), attempt to resolve them
     //   them from kernel symbols
     else if (st_type == STT_NOTYPE)
@@ -488,219 +959,806 @@ static elf32_addr symbol_addr(struct kelf* elf, elf32_sym* sym)
     return S;
 }
 
-//! Allocate the relocation status table, and set
-//!   all relocations' status to 'not done' (i.e 0)
+//! Check if a relocation section applies to the program's
+//!   memory image (and not to debug or other unloaded sections)
+//! \param elf The elf to work on
+//! \param shdr The section header to check
+//! \return 1 if so, 0 otherwise
+static int loaded_rels(struct kelf* elf, elf32_shdr* shdr)
+{
+    if (shdr->sh_type != SHT_REL || shdr->sh_entsize != sizeof(elf32_rel))
+        return 0;
+
+    return shdr->sh_info < elf->header->e_shnum && elf->shaddr[shdr->sh_info];
+}
+
+//! Allocate the pending relocations bitset for elf->rels_count
+//!   relocations, and mark all of them as pending
 //! \param elf The elf to work on
 //! \return 0 if OK, -1 otherwise
-static int alloc_rels_statuses(struct kelf* elf)
+static int alloc_pending(struct kelf* elf)
 {
-    if (!elf || !elf->progmem)
+    elf->rels_left = elf->rels_count;
+    if (!elf->rels_count)
+        return 0;
+
+    // One bit per relocation, set while it is pending
+    elf32_word words = (elf->rels_count + 31) / 32;
+    elf->rels_pending = kmalloc(words * sizeof(elf32_word));
+    if (!elf->rels_pending)
         return -1;
 
-    int nsections = 0;
+    memset(elf->rels_pending, 0xFF, words * sizeof(elf32_word));
 
-    // Get the number of relocation sections
-    for (elf32_word i = 0; i < elf->header->e_shnum; ++i)
-    {
-        elf32_shdr* shdr = section(elf, i);
-        if (shdr->sh_type != SHT_REL)
-            continue;
-        ++nsections;
-    }
+    return 0;
+}
 
-    // Allocate main array
-    elf->rels_statuses_size = nsections;
-    elf->rels_statuses = kmalloc(nsections * sizeof(int*));
-    if (!elf->rels_statuses)
+//! Allocate the pending relocations bitset, and mark
+//!   all relocations as pending
+//! \param elf The elf to work on
+//! \return 0 if OK, -1 otherwise
+static int alloc_rels(struct kelf* elf)
+{
+    if (!elf || !elf->progmem)
         return -1;
 
-    int sid = 0;
+    // Count relocations, and check if some of them patch the blob
+    int xip = 0;
+    elf->rels_count = 0;
     for (elf32_word i = 0; i < elf->header->e_shnum; ++i)
     {
         elf32_shdr* shdr = section(elf, i);
-        if (shdr->sh_type != SHT_REL)
+        if (!loaded_rels(elf, shdr))
             continue;
 
-        // Number of relocations in this section
-        int nrels = shdr->sh_size / shdr->sh_entsize;
-
-        // Allocate array
-        elf->rels_statuses[sid] = kmalloc(sizeof(int));
-        if (!elf->rels_statuses[sid])
-            return -1;
+        elf->rels_count += shdr->sh_size / shdr->sh_entsize;
+        if (in_place(elf, section(elf, shdr->sh_info)))
+            xip = 1;
+    }
 
-        // Set all relocation statuses to 'not done'
-        for (int rid = 0; rid < nrels; ++rid)
-            elf->rels_statuses[sid][rid] = 0;
+    if (alloc_pending(elf) < 0)
+        return -1;
 
-        ++sid;
+    // Keep the original words to restore the blob on unload
+    if (xip && elf->rels_count)
+    {
+        elf->rels_orig = kmalloc(elf->rels_count * sizeof(elf32_word));
+        if (!elf->rels_orig)
+            return -1;
     }
 
     return 0;
 }
 
-//! Release the relocations' statuses table
+//! Release the relocations' bookkeeping
 //! \param elf The elf blob to work on
-//! \return 0 if OK, -1 otherwise
-static int free_rels_statuses(struct kelf* elf)
+static void free_rels(struct kelf* elf)
 {
-    if (!elf || !elf->rels_statuses)
-        return -1;
-
-    for (int sid = 0; sid < elf->rels_statuses_size; ++sid)
-    {
-        kfree(elf->rels_statuses[sid]);
-    }
+    kfree(elf->rels_pending);
+    kfree(elf->rels_orig);
 
-    kfree(elf->rels_statuses);
-
-    return 0;
+    elf->rels_pending = 0;
+    elf->rels_orig = 0;
+    elf->rels_count = 0;
+    elf->rels_left = 0;
 }
 
-//! Get a pointer to the status of a relocation, given
-//!   its relocation section id and relocation id
-//! \param elf The elf to work on
-//! \param sid The relocation section id (*not* the elf section id)
-//! \param rid The relocation id inside its own section
-//! \return A pointer to the relocation's status, 0 if error(s) occured
-static int* rel_status(struct kelf* elf, int sid, int rid)
+//! Check if a relocation may need a veneer, i.e if it is
+//!   a Thumb call or jump to a symbol outside of the module
+//! \param elf The elf blob to work on
+//! \param rel The relocation to check
+//! \return 1 if so, 0 otherwise
+static int needs_veneer(struct kelf* elf, elf32_rel* rel)
 {
-    if (!elf || !elf->rels_statuses || sid >= elf->rels_statuses_size)
+    elf32_word r_type = ELF32_R_TYPE(rel->r_info);
+    if (r_type != R_ARM_THM_CALL && r_type != R_ARM_THM_JUMP24)
         return 0;
 
-    return elf->rels_statuses[sid] + rid;
+    elf32_sym* sym = symbol(elf, ELF32_R_SYM(rel->r_info));
+    return sym && sym->st_shndx == SHN_UNDEF;
 }
 
-//! Apply a relocation to the process' image
+//! Allocate one branch veneer per external symbol called
+//!   by the module. A veneer is a `ldr.w pc, [pc, #0]` followed
+//!   by the target's address, so that code in RAM can reach
+//!   the kernel in flash, out of range of a BL.
 //! \param elf The elf blob to work on
-//! \param shdr The relocation's section header
-//! \param rel The relocation to apply
 //! \return 0 on success, -1 otherwise
-static int do_rel_for_section(struct kelf* elf, elf32_shdr* shdr, elf32_rel* rel)
+static int alloc_veneers(struct kelf* elf)
 {
-    if (!elf || !shdr || shdr->sh_type != SHT_REL || !elf->progmem || !rel)
+    if (!elf || !elf->shaddr)
         return -1;
 
-    // Get relocation parameters
-    elf32_word r_sym = ELF32_R_SYM(rel->r_info);
-    elf32_word r_type = ELF32_R_TYPE(rel->r_info);
+    elf32_word nsyms = elf->symtab->sh_size / elf->symtab->sh_entsize;
 
-    // Get the relocation's section address
-    elf32_addr r_shaddr = 0x00;
-    for (elf32_word i = 0; i < elf->allocshnum; ++i)
-    {
-        if (elf->allocsh[i] == shdr->sh_info)
-            r_shaddr = ((elf32_addr)elf->progmem) + elf->progmem_shoff[i];
-    }
+    // Indexes are stored as half-words
+    if (nsyms > 0xFFFF)
+        return -1;
 
-    elf32_sym* sym = symbol(elf, r_sym);
-    if (!sym)
+    elf->veneer_of = kmalloc(nsyms * sizeof(elf32_half));
+    if (!elf->veneer_of)
         return -1;
+    memset(elf->veneer_of, 0, nsyms * sizeof(elf32_half));
 
-    elf32_word T = ELF32_ST_TYPE(sym->st_info) == STT_FUNC ? 0x01 : 0x00;
+    // One veneer per called symbol
+    for (elf32_word i = 0; i < elf->header->e_shnum; ++i)
+    {
+        elf32_shdr* shdr = section(elf, i);
+        if (!loaded_rels(elf, shdr))
+            continue;
 
-    elf32_addr S = symbol_addr(elf, sym);
-    if (!S)
-        return -1;
+        elf32_word n = 0;
+        for (elf32_word j = 0; j < shdr->sh_size / shdr->sh_entsize; j += n)
+        {
+            elf32_rel* rels = rels_chunk(elf, shdr, j, &n);
+            if (!rels)
+                return -1;
 
-    // Location to relocate
-    elf32_word* P = (elf32_word*)(r_shaddr + rel->r_offset);
+            for (elf32_word k = 0; k < n; ++k)
+            {
+                if (!needs_veneer(elf, &rels[k]))
+                    continue;
 
-    // Simple 32-bit word relocation
-    if (r_type == R_ARM_ABS32)
-    {
-        elf32_word A = *P;
-        *P = (S + A) | T;
+                elf32_word r_sym = ELF32_R_SYM(rels[k].r_info);
+                if (r_sym >= nsyms)
+                    return -1;
+
+                if (!elf->veneer_of[r_sym])
+                    elf->veneer_of[r_sym] = ++elf->veneernum;
+            }
+        }
     }
-    // Thumb call relocation
-    else if (r_type == R_ARM_THM_CALL)
-    {
-        elf32_half upper_insn = ((elf32_half*)P)[0];
-        elf32_half lower_insn = ((elf32_half*)P)[1];
 
-        elf32_word s = (upper_insn >> 10) & 1;
-        elf32_word j1 = (lower_insn >> 13) & 1;
-        elf32_word j2 = (lower_insn >> 11) & 1;
+    if (!elf->veneernum)
+        return 0;
 
-        elf32_sword off = (s << 24) | ((~(j1 ^ s) & 1) << 23) | ((~(j2 ^ s) & 1) << 22) |
-                          ((upper_insn & 0x03ff) << 12) | ((lower_insn & 0x07ff) << 1);
+    // The target address is filled in when relocating
+    elf->veneers = kmalloc(elf->veneernum * veneer_words(elf) * sizeof(elf32_word));
+    if (!elf->veneers)
+        return -1;
 
-        if (off & 0x01000000)
-            off -= 0x02000000;
+    for (elf32_word i = 0; i < nsyms; ++i)
+    {
+        if (!elf->veneer_of[i])
+            continue;
 
-        off += S - (elf32_word)P;
+        elf32_word* veneer = elf->veneers + (elf->veneer_of[i] - 1) * veneer_words(elf);
 
-        s = (off >> 24) & 1;
-        j1 = s ^ (~(off >> 23) & 1);
-        j2 = s ^ (~(off >> 22) & 1);
+        veneer[0] = 0xf000f8df;
+        veneer[VENEER_TARGET] = 0;
 
-        upper_insn = ((upper_insn & 0xf800) | (s << 10) | ((off >> 12) & 0x03ff));
-        lower_insn = ((lower_insn & 0xd000) | (j1 << 13) | (j1 << 11) | ((off >> 1) & 0x07ff));
+        // Lazy stubs start by jumping to their second half, which
+        //   calls kelf_lazy_resolve with r12 = stub + 12 :
+        //     mov ip, pc ; ldr.w pc, [pc, #4] ; nop
+        //     .word kelf_lazy_resolve
+        //     .word <symbol name>
+        if (elf->flags & KELF_F_LAZY)
+        {
+            elf32_sym* sym = symbol(elf, i);
 
-        ((elf32_half*)P)[0] = upper_insn;
-        ((elf32_half*)P)[1] = lower_insn;
+            veneer[VENEER_TARGET] = (elf32_word)(veneer + 2) | 0x01;
+            veneer[2] = 0xf8df46fc;
+            veneer[3] = 0xbf00f004;
+            veneer[4] = (elf32_word)kelf_lazy_resolve;
+            veneer[LAZY_STUB_NAME] = (elf32_word)symbol_name(elf, sym);
+        }
     }
-    else
-        return -1;
 
     return 0;
 }
 
-//! Apply all relocations for a given relocation section
+//! Get the size of the veneers
 //! \param elf The elf blob to work on
-//! \param shdr The relocation section header
-//! \return 0 if suceeded, -1 otherwise
-static int do_rels_for_section(struct kelf* elf, elf32_shdr* shdr, int sid)
+//! \return The size in words of a veneer
+static elf32_word veneer_words(struct kelf* elf)
+{
+    return (elf->flags & KELF_F_LAZY) ? LAZY_STUB_WORDS : VENEER_WORDS;
+}
+
+//! Find the veneer of an external symbol
+//! \param elf The elf blob to work on
+//! \param r_sym The symbol's index
+//! \return A pointer to the veneer, 0 if there is none
+static elf32_word* find_veneer(struct kelf* elf, elf32_word r_sym)
+{
+    if (!elf->veneers || !elf->veneer_of)
+        return 0;
+
+    if (r_sym >= elf->symtab->sh_size / elf->symtab->sh_entsize || !elf->veneer_of[r_sym])
+        return 0;
+
+    return elf->veneers + (elf->veneer_of[r_sym] - 1) * veneer_words(elf);
+}
+
+//! Get the size of the location patched by a relocation
+//! \param r_type The relocation's type
+//! \return The size in bytes of the patched location
+static elf32_word rel_size(elf32_word r_type)
+{
+    if (r_type == R_ARM_THM_JUMP11 || r_type == R_ARM_THM_JUMP8)
+        return sizeof(elf32_half);
+    if (r_type == R_ARM_V4BX)
+        return 0;
+
+    return sizeof(elf32_word);
+}
+
+//! Relocate a 32-bit Thumb BL / B.W instruction
+//! \param P The instruction's address
+//! \param S The branch target
+//! \return 0 on success, -1 if the target is out of range
+static int rel_thm_branch(elf32_half* P, elf32_addr S)
+{
+    elf32_half upper_insn = P[0];
+    elf32_half lower_insn = P[1];
+
+    elf32_word s = (upper_insn >> 10) & 1;
+    elf32_word j1 = (lower_insn >> 13) & 1;
+    elf32_word j2 = (lower_insn >> 11) & 1;
+
+    elf32_sword off = (s << 24) | ((~(j1 ^ s) & 1) << 23) | ((~(j2 ^ s) & 1) << 22) |
+                      ((upper_insn & 0x03ff) << 12) | ((lower_insn & 0x07ff) << 1);
+
+    if (off & 0x01000000)
+        off -= 0x02000000;
+
+    off += S - (elf32_addr)P;
+
+    // +/- 16MiB
+    if (off < -0x01000000 || off > 0x00fffffe)
+        return -1;
+
+    s = (off >> 24) & 1;
+    j1 = s ^ (~(off >> 23) & 1);
+    j2 = s ^ (~(off >> 22) & 1);
+
+    P[0] = ((upper_insn & 0xf800) | (s << 10) | ((off >> 12) & 0x03ff));
+    P[1] = ((lower_insn & 0xd000) | (j1 << 13) | (j2 << 11) | ((off >> 1) & 0x07ff));
+
+    return 0;
+}
+
+//! Relocate a 16-bit Thumb B / B<cond> instruction
+//! \param P The instruction's address
+//! \param S The branch target
+//! \param bits Size of the instruction's offset field
+//! \return 0 on success, -1 if the target is out of range
+static int rel_thm_short_branch(elf32_half* P, elf32_addr S, int bits)
 {
-    if (!elf || !shdr || shdr->sh_type != SHT_REL || !elf->progmem)
+    elf32_half mask = (1 << bits) - 1;
+    elf32_sword sign = 1 << bits;
+
+    elf32_sword off = (*P & mask) << 1;
+    if (off & sign)
+        off -= sign << 1;
+
+    off += S - (elf32_addr)P;
+
+    if (off < -sign || off >= sign)
         return -1;
 
-    int ok = 0;
+    *P = (*P & ~mask) | ((off >> 1) & mask);
 
-    int rid = 0;
-    for (elf32_word i = 0; i < shdr->sh_size / shdr->sh_entsize; ++i)
-    {
-        elf32_rel* rel = (elf32_rel*)(elf->raw + shdr->sh_offset + i * shdr->sh_entsize);
+    return 0;
+}
+
+//! Get the immediate of a Thumb MOVW / MOVT instruction
+//! \param P The instruction's address
+//! \return The 16-bit immediate
+static elf32_word thm_mov_get(elf32_half* P)
+{
+    return ((P[0] & 0x000f) << 12) | ((P[0] & 0x0400) << 1) | ((P[1] & 0x7000) >> 4) | (P[1] & 0x00ff);
+}
+
+//! Set the immediate of a Thumb MOVW / MOVT instruction
+//! \param P The instruction's address
+//! \param value The immediate (only the lower 16 bits are used)
+static void thm_mov_set(elf32_half* P, elf32_word value)
+{
+    P[0] = (P[0] & 0xfbf0) | ((value & 0xf000) >> 12) | ((value & 0x0800) >> 1);
+    P[1] = (P[1] & 0x8f00) | ((value & 0x0700) << 4) | (value & 0x00ff);
+}
+
+//! Relocate a Thumb MOVW / MOVT instruction pair half
+//! \param P The instruction's address
+//! \param value The value to load
+//! \param upper 1 for MOVT (upper 16 bits), 0 for MOVW
+static void rel_thm_mov(elf32_half* P, elf32_word value, int upper)
+{
+    // The addend is the signed 16-bit immediate
+    elf32_sword A = thm_mov_get(P);
+    A = (A ^ 0x8000) - 0x8000;
 
-        // 'rid' is the number of the relocation, in order
-        int* status = rel_status(elf, sid, rid++);
-        if (!status)
+    value += A;
+    if (upper)
+        value >>= 16;
+
+    thm_mov_set(P, value);
+}
+
+//! Apply a relocation to the process' image
+//! \param elf The elf blob to work on
+//! \param base Address of the section to relocate
+//! \param rel The relocation to apply
+//! \param orig Where to save the patched location, if not 0
+//! \return 0 on success, -1 otherwise
+static int do_rel(struct kelf* elf, elf32_addr base, elf32_rel* rel, elf32_word* orig)
+{
+    // Get relocation parameters
+    elf32_word r_sym = ELF32_R_SYM(rel->r_info);
+    elf32_word r_type = ELF32_R_TYPE(rel->r_info);
+
+    // Nothing to do on ARMv7-M
+    if (r_type == R_ARM_V4BX)
+        return 0;
+
+    elf32_sym* sym = symbol(elf, r_sym);
+    if (!sym)
+        return -1;
+
+    // Lazy binding : calls to external symbols go through their
+    //   stub, the symbol is only looked up on the first call
+    if ((elf->flags & KELF_F_LAZY) && needs_veneer(elf, rel))
+    {
+        elf32_word* veneer = find_veneer(elf, r_sym);
+        elf32_half* P = (elf32_half*)(base + rel->r_offset);
+        if (!veneer)
             return -1;
 
-        if (*status == 0)
+        if (orig)
+            memcpy(orig, P, rel_size(r_type));
+
+        return rel_thm_branch(P, (elf32_addr)veneer);
+    }
+
+    elf32_word T = ELF32_ST_TYPE(sym->st_info) == STT_FUNC ? 0x01 : 0x00;
+
+    elf32_addr S = symbol_addr(elf, sym);
+    if (!S)
+        return -1;
+
+    // Location to relocate
+    elf32_word* P = (elf32_word*)(base + rel->r_offset);
+
+    // Thumb instructions are only half-word aligned
+    if (orig)
+        memcpy(orig, P, rel_size(r_type));
+
+    switch (r_type)
+    {
+        // Simple 32-bit word relocations
+        case R_ARM_ABS32:
+        case R_ARM_TARGET1:
+            *P = (S + *P) | T;
+            break;
+
+        case R_ARM_REL32:
+            *P = ((S + *P) | T) - (elf32_addr)P;
+            break;
+
+        // Exception tables, keep the top bit
+        case R_ARM_PREL31:
         {
-            if (do_rel_for_section(elf, shdr, rel) < 0)
-                ok = -1;
-            else
-                *status = 1;
+            elf32_sword off = (elf32_sword)(*P << 1) >> 1;
+            off = ((S + off) | T) - (elf32_addr)P;
+
+            if (off < -0x40000000 || off > 0x3fffffff)
+                return -1;
+
+            *P = (*P & 0x80000000) | (off & 0x7fffffff);
+            break;
+        }
+
+        // Thumb calls and branches, going through the
+        //   symbol's veneer if it is out of range
+        case R_ARM_THM_CALL:
+        case R_ARM_THM_JUMP24:
+        {
+            if (rel_thm_branch((elf32_half*)P, S) == 0)
+                break;
+
+            elf32_word* veneer = find_veneer(elf, r_sym);
+            if (!veneer)
+                return -1;
+
+            veneer[VENEER_TARGET] = S | 0x01;
+            return rel_thm_branch((elf32_half*)P, (elf32_addr)veneer);
         }
+
+        case R_ARM_THM_JUMP11:
+            return rel_thm_short_branch((elf32_half*)P, S, 11);
+
+        case R_ARM_THM_JUMP8:
+            return rel_thm_short_branch((elf32_half*)P, S, 8);
+
+        // Thumb absolute address loads
+        case R_ARM_THM_MOVW_ABS_NC:
+            rel_thm_mov((elf32_half*)P, S | T, 0);
+            break;
+
+        case R_ARM_THM_MOVT_ABS:
+            rel_thm_mov((elf32_half*)P, S, 1);
+            break;
+
+        default:
+            return -1;
     }
 
-    return ok;
+    return 0;
 }
 
-//! Apply all relocations for the given elf blob
+//! Apply all pending relocations for the given elf blob,
+//!   in a single pass over the relocation sections
 //! \param elf The elf blob to work on
-//! \return 0 on success, -1 otherwise
+//! \return 0 if all relocations are done, -1 otherwise
 static int do_rels(struct kelf* elf)
 {
     if (!elf || !elf->progmem)
         return -1;
 
-    int ok = 0;
-    int sid = 0;
-    for (elf32_word i = 0; i < elf->header->e_shnum; ++i)
+    if (elf->image)
+        return do_imports(elf);
+
+    // 'rid' numbers relocations across all sections, in order
+    elf32_word rid = 0;
+    for (elf32_word i = 0; i < elf->header->e_shnum && elf->rels_left; ++i)
+    {
+        elf32_shdr* shdr = section(elf, i);
+        if (!loaded_rels(elf, shdr))
+            continue;
+
+        elf32_addr base = elf->shaddr[shdr->sh_info];
+        elf32_word nrels = shdr->sh_size / shdr->sh_entsize;
+
+        elf32_word n = 0;
+        for (elf32_word j = 0; j < nrels; j += n)
+        {
+            elf32_rel* rels = rels_chunk(elf, shdr, j, &n);
+            if (!rels)
+                return -1;
+
+            for (elf32_word k = 0; k < n; ++k, ++rid)
+            {
+                elf32_word bit = 1 << (rid % 32);
+                if (!(elf->rels_pending[rid / 32] & bit))
+                    continue;
+
+                elf32_word* orig = elf->rels_orig ? elf->rels_orig + rid : 0;
+                if (do_rel(elf, base, &rels[k], orig) < 0)
+                    continue;
+
+                elf->rels_pending[rid / 32] &= ~bit;
+                --elf->rels_left;
+            }
+        }
+    }
+
+    return elf->rels_left ? -1 : 0;
+}
+
+//! Undo the relocations applied to sections left
+//!   in place, restoring the blob's original contents.
+//!   Relocations are undone in reverse order, so that a
+//!   word patched several times gets its first saved value.
+//! \param elf The elf blob to work on
+static void restore_in_place(struct kelf* elf)
+{
+    if (elf->image || !elf->rels_pending || !elf->rels_orig)
+        return;
+
+    // Walk back from the last relocation
+    elf32_word rid = elf->rels_count;
+    for (elf32_word i = elf->header->e_shnum; i-- > 0;)
     {
         elf32_shdr* shdr = section(elf, i);
-        if (shdr->sh_type != SHT_REL)
+        if (!loaded_rels(elf, shdr))
+            continue;
+
+        elf32_word nrels = shdr->sh_size / shdr->sh_entsize;
+        rid -= nrels;
+
+        // Relocations patching program memory don't matter
+        if (!in_place(elf, section(elf, shdr->sh_info)))
+            continue;
+
+        elf32_addr base = elf->shaddr[shdr->sh_info];
+        char* rels = (char*)(elf->raw + shdr->sh_offset);
+
+        for (elf32_word j = nrels; j-- > 0;)
+        {
+            if (elf->rels_pending[(rid + j) / 32] & (1 << ((rid + j) % 32)))
+                continue;
+
+            elf32_rel* rel = (elf32_rel*)(rels + j * shdr->sh_entsize);
+            elf32_addr P = base + rel->r_offset;
+            elf32_word r_type = ELF32_R_TYPE(rel->r_info);
+            memcpy((void*)P, elf->rels_orig + rid + j, rel_size(r_type));
+        }
+    }
+}
+
+//! Get the parts of a prelinked module image
+//! \param elf The elf to work on
+//! \param fixups Where to store the fixup stream's address
+//! \param imports Where to store the import table's address
+//! \param exports Where to store the export table's address
+//! \return The string table's address
+static const char* image_parts(struct kelf* elf, const uint8_t** fixups,
+                               struct kmodimg_symbol** imports, struct kmodimg_symbol** exports)
+{
+    struct kmodimg_header* image = elf->image;
+    char* p = elf->imgtail;
+
+    *fixups = (const uint8_t*)p;
+    p += KMODIMG_ALIGN(image->fixups_size);
+    *imports = (struct kmodimg_symbol*)p;
+    p += image->nimports * sizeof(struct kmodimg_symbol);
+    *exports = (struct kmodimg_symbol*)p;
+    p += image->nexports * sizeof(struct kmodimg_symbol);
+
+    return p;
+}
+
+//! Read an ULEB128 number from a fixup stream
+//! \param p The stream pointer, advanced past the number
+//! \param end End of the stream
+//! \return The decoded number
+static elf32_word read_uleb(const uint8_t** p, const uint8_t* end)
+{
+    elf32_word value = 0;
+
+    for (int shift = 0; *p < end && shift < 32; shift += 7)
+    {
+        uint8_t byte = *(*p)++;
+        value |= (elf32_word)(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80))
+            break;
+    }
+
+    return value;
+}
+
+//! Load a prelinked module image : copy it in program memory,
+//!   and add the load address to the locations that depend on it
+//! \param elf The elf to work on
+//! \return 0 on success, -1 otherwise
+static int load_image(struct kelf* elf)
+{
+    struct kmodimg_header* image = elf->image;
+
+    // The image is only valid for the kernel it was linked against
+    if (image->ksymtab_sum != ksymtab_checksum())
+        return -1;
+    if (image->copy_size > image->load_size)
+        return -1;
+
+    elf->progmem_size = image->load_size;
+    elf->progmem = kmalloc(elf->progmem_size ? elf->progmem_size : 1);
+    if (!elf->progmem)
+        return -1;
+
+    elf32_off tail = sizeof(struct kmodimg_header) + KMODIMG_ALIGN(image->copy_size);
+    elf32_word tail_size = KMODIMG_ALIGN(image->fixups_size)
+                         + (image->nimports + image->nexports) * sizeof(struct kmodimg_symbol)
+                         + image->strtab_size;
+
+    if (streamed(elf))
+    {
+        if (elf->reader.read(elf->reader.ctx, sizeof(struct kmodimg_header), elf->progmem, image->copy_size) < 0)
+            return -1;
+    }
+    else
+    {
+        memcpy(elf->progmem, image + 1, image->copy_size);
+    }
+    memset(elf->progmem + image->copy_size, 0, image->load_size - image->copy_size);
+
+    elf->imgtail = fetch(elf, tail, tail_size);
+    if (!elf->imgtail)
+        return -1;
+
+    const uint8_t* f;
+    struct kmodimg_symbol* imports;
+    struct kmodimg_symbol* exports;
+    image_parts(elf, &f, &imports, &exports);
+
+    const uint8_t* end = f + image->fixups_size;
+    elf32_addr base = (elf32_addr)elf->progmem;
+    elf32_word off = 0;
+
+    while (f < end)
+    {
+        elf32_word fix = read_uleb(&f, end);
+        off += (fix >> KMODIMG_FIX_BITS) << 1;
+
+        if (off + sizeof(elf32_word) > elf->progmem_size)
+            return -1;
+
+        elf32_half* P = (elf32_half*)(elf->progmem + off);
+
+        switch (fix & ((1 << KMODIMG_FIX_BITS) - 1))
+        {
+            case KMODIMG_FIX_WORD:
+                *(elf32_word*)P += base;
+                break;
+
+            case KMODIMG_FIX_MOVW:
+                thm_mov_set(P, thm_mov_get(P) + base);
+                break;
+
+            case KMODIMG_FIX_MOVT:
+            {
+                elf32_word value = (thm_mov_get(P) << 16) | read_uleb(&f, end);
+                thm_mov_set(P, (value + base) >> 16);
+                break;
+            }
+
+            default:
+                return -1;
+        }
+    }
+
+    // Imports are resolved along with relocations
+    elf->rels_count = image->nimports;
+    return alloc_pending(elf);
+}
+
+//! Resolve the pending imports of a prelinked module image
+//! \param elf The elf to work on
+//! \return 0 if all imports are resolved, -1 otherwise
+static int do_imports(struct kelf* elf)
+{
+    const uint8_t* fixups;
+    struct kmodimg_symbol* imports;
+    struct kmodimg_symbol* exports;
+    const char* strtab = image_parts(elf, &fixups, &imports, &exports);
+
+    for (elf32_word i = 0; i < elf->rels_count && elf->rels_left; ++i)
+    {
+        elf32_word bit = 1 << (i % 32);
+        if (!(elf->rels_pending[i / 32] & bit))
             continue;
 
-        // 'sid' is the number of the relocation section, in order
-        if (do_rels_for_section(elf, shdr, sid++) < 0)
-            ok = -1;
+        if (imports[i].offset + sizeof(elf32_word) > elf->progmem_size)
+            return -1;
+
+        elf32_addr S = (elf32_addr)ksymbol(strtab + imports[i].name);
+        if (!S)
+            continue;
+
+        *(elf32_word*)(elf->progmem + imports[i].offset) += S;
+
+        elf->rels_pending[i / 32] &= ~bit;
+        --elf->rels_left;
+    }
+
+    return elf->rels_left ? -1 : 0;
+}
+
+//! Find a symbol exported by a prelinked module image
+//! \param elf The elf to work on
+//! \param name The symbol's name
+//! \return The symbol's address, 0 if not found
+static void* image_symbol(struct kelf* elf, const char* name)
+{
+    const uint8_t* fixups;
+    struct kmodimg_symbol* imports;
+    struct kmodimg_symbol* exports;
+    const char* strtab = image_parts(elf, &fixups, &imports, &exports);
+
+    for (elf32_word i = 0; i < elf->image->nexports; ++i)
+    {
+        if (strcmp(strtab + exports[i].name, name) == 0)
+            return elf->progmem + exports[i].offset;
+    }
+
+    return 0;
+}
+
+//! Check if some sections of an elf are left in place
+//! \param elf The elf to work on
+//! \return 1 if so, 0 otherwise
+static int has_in_place(struct kelf* elf)
+{
+    for (elf32_word i = 0; i < elf->allocshnum; ++i)
+    {
+        if (elf->progmem_shoff[i] == IN_PLACE)
+            return 1;
+    }
+
+    return 0;
+}
+
+//! Copy the exported symbols (and the names used by lazy
+//!   stubs) out of the blob, into a single block
+//! \param elf The elf to work on
+//! \return 0 on success, -1 otherwise
+static int snapshot_exports(struct kelf* elf)
+{
+    const uint8_t* fixups;
+    struct kmodimg_symbol* imports;
+    struct kmodimg_symbol* exports = 0;
+    const char* strtab = 0;
+
+    // Count the exported symbols, and the size of their names
+    elf32_word count = 0;
+    elf32_word size = 0;
+
+    if (elf->image)
+    {
+        strtab = image_parts(elf, &fixups, &imports, &exports);
+        count = elf->image->nexports;
+
+        for (elf32_word i = 0; i < count; ++i)
+            size += strlen(strtab + exports[i].name) + 1;
+    }
+    else
+    {
+        for (elf32_word i = first_global(elf); i < elf->symtab->sh_size / elf->symtab->sh_entsize; ++i)
+        {
+            elf32_sym* sym = symbol(elf, i);
+            if (!exported(sym))
+                continue;
+
+            ++count;
+            size += strlen(symbol_name(elf, sym)) + 1;
+        }
+    }
+
+    if (elf->flags & KELF_F_LAZY)
+    {
+        for (elf32_word i = 0; i < elf->veneernum; ++i)
+            size += strlen((const char*)elf->veneers[i * LAZY_STUB_WORDS + LAZY_STUB_NAME]) + 1;
+    }
+
+    // (at least one byte, even without any symbol)
+    struct kelf_export* table = kmalloc(count * sizeof(struct kelf_export) + size + 1);
+    if (!table)
+        return -1;
+
+    // Fill the table, names go after it
+    char* names = (char*)(table + count);
+
+    for (elf32_word i = 0, j = 0, first = elf->image ? 0 : first_global(elf); j < count; ++i)
+    {
+        const char* name;
+
+        if (elf->image)
+        {
+            name = strtab + exports[i].name;
+        }
+        else
+        {
+            elf32_sym* sym = symbol(elf, first + i);
+            if (!exported(sym))
+                continue;
+
+            name = symbol_name(elf, sym);
+        }
+
+        table[j].addr = kelf_symbol(elf, name);
+        table[j].name = strcpy(names, name);
+        names += strlen(name) + 1;
+        ++j;
+    }
+
+    if (elf->flags & KELF_F_LAZY)
+    {
+        for (elf32_word i = 0; i < elf->veneernum; ++i)
+        {
+            elf32_word* stub = elf->veneers + i * LAZY_STUB_WORDS;
+
+            strcpy(names, (const char*)stub[LAZY_STUB_NAME]);
+            stub[LAZY_STUB_NAME] = (elf32_word)names;
+            names += strlen(names) + 1;
+        }
     }
 
-    return ok;
+    elf->exports = table;
+    elf->nexports = count;
+
+    return 0;
 }
 
 //! Perform the whole elf loading process :
@@ -717,19 +1775,30 @@ static int load(struct kelf* elf)
 
     if (header_check(elf) < 0)
         return -1;
+
+    elf->shtab = fetch(elf, elf->header->e_shoff, elf->header->e_shnum * elf->header->e_shentsize);
+    if (!elf->shtab)
+        return -1;
+
     if (find_shstrtab(elf) == SHN_UNDEF)
         return -1;
     if (find_symtab(elf) == SHN_UNDEF)
         return -1;
     if (find_symstrtab(elf) == SHN_UNDEF)
         return -1;
+    if (fetch_tables(elf) < 0)
+        return -1;
+    if (build_symhash(elf) < 0)
+        return -1;
     if (find_allocsh(elf) < 0)
         return -1;
     if (alloc_progmem(elf) < 0)
         return -1;
     if (load_progmem(elf) < 0)
         return -1;
-    if (alloc_rels_statuses(elf) < 0)
+    if (alloc_veneers(elf) < 0)
+        return -1;
+    if (alloc_rels(elf) < 0)
         return -1;
 
     return 0;
@@ -744,38 +1813,134 @@ static int unload(struct kelf* elf)
     if (!elf)
         return -1;
 
-    free_rels_statuses(elf);
+    restore_in_place(elf);
+    free_rels(elf);
+    kfree(elf->exports);
     kfree(elf->progmem);
     kfree(elf->progmem_shoff);
+    kfree(elf->shaddr);
     kfree(elf->allocsh);
+    kfree(elf->symhash);
+    kfree(elf->veneer_of);
+    kfree(elf->veneers);
+    release_tables(elf);
 
-    elf->shstrtab = 0;
-    elf->symtab = 0;
-    elf->symstrtab = 0;
     elf->allocsh = 0;
     elf->allocshnum = 0;
     elf->progmem_shoff = 0;
+    elf->shaddr = 0;
+    elf->symhash = 0;
+    elf->veneer_of = 0;
+    elf->veneernum = 0;
+    elf->veneers = 0;
+    elf->exports = 0;
+    elf->nexports = 0;
+    elf->symhash_mask = 0;
+    elf->sysvhash = 0;
     elf->progmem_size = 0;
     elf->progmem = 0;
 
     return 0;
 }
 
+//! Bind the symbol of a lazy stub, on the first call through it
+//!   (called by kelf_lazy_resolve)
+//! \param stub The lazy stub
+//! \return The symbol's address
+elf32_addr kelf_lazy_bind(elf32_word* stub)
+{
+    const char* name = (const char*)stub[LAZY_STUB_NAME];
+
+    elf32_addr S = (elf32_addr)ksymbol(name);
+    if (!S)
+    {
+        kprint(KPRINT_ERR "kelf: unresolved symbol '%s' called by task %d\n", name, ksched_getpid());
+
+        // There is no way back to the caller, so kill it (this
+        //   only returns in an interrupt handler, that is left stuck)
+        ksched_exit();
+        for (;;)
+            ;
+    }
+
+    // A single word store, concurrent callers write the same value
+    stub[VENEER_TARGET] = S | 0x01;
+
+    return S | 0x01;
+}
+
 /////////////////////////////
 //// Public module's API ////
 /////////////////////////////
 
-struct kelf* kelf_load(void* raw)
+struct kelf* kelf_load(void* raw, int flags)
 {
     if (!raw)
         return 0;
 
     struct kelf* elf = kmalloc(sizeof(struct kelf));
+    if (!elf)
+        return 0;
+
+    memset(elf, 0, sizeof(struct kelf));
     elf->raw = raw;
+    elf->header = raw;
+    elf->flags = flags;
 
-    if (load(elf) < 0)
+    // Prelinked images have their own format
+    if (*(uint32_t*)raw == KMODIMG_MAGIC)
+        elf->image = raw;
+
+    // The blob belongs to the caller, only release
+    //   what load() managed to allocate
+    if ((elf->image ? load_image(elf) : load(elf)) < 0)
     {
-        kfree(elf->raw);
+        unload(elf);
+        kfree(elf);
+        return 0;
+    }
+
+    elf->needs_fix = (do_rels(elf) < 0) ? 1 : 0;
+
+    return elf;
+}
+
+struct kelf* kelf_load_stream(const struct kelf_reader* reader, int flags)
+{
+    if (!reader || !reader->read)
+        return 0;
+
+    struct kelf* elf = kmalloc(sizeof(struct kelf));
+    if (!elf)
+        return 0;
+
+    memset(elf, 0, sizeof(struct kelf));
+    elf->reader = *reader;
+    elf->flags = flags & ~(KELF_F_XIP | KELF_F_OWNED);
+
+    // Prelinked images have their own format, and
+    //   their header is kept instead of the elf one
+    uint32_t magic;
+    int ret = -1;
+
+    if (reader->read(reader->ctx, 0, &magic, sizeof(magic)) == 0)
+    {
+        if (magic == KMODIMG_MAGIC)
+        {
+            elf->header = fetch(elf, 0, sizeof(struct kmodimg_header));
+            elf->image = (struct kmodimg_header*)elf->header;
+            ret = elf->image ? load_image(elf) : -1;
+        }
+        else
+        {
+            elf->header = fetch(elf, 0, sizeof(elf32_header));
+            ret = elf->header ? load(elf) : -1;
+        }
+    }
+
+    if (ret < 0)
+    {
+        unload(elf);
         kfree(elf);
         return 0;
     }
@@ -798,6 +1963,9 @@ int kelf_fix_relocations(kelf* elf)
     if (!elf)
         return -1;
 
+    if (!elf->needs_fix)
+        return 0;
+
     if (do_rels(elf) < 0)
         return -1;
 
@@ -805,6 +1973,48 @@ int kelf_fix_relocations(kelf* elf)
     return 0;
 }
 
+int kelf_finalize(struct kelf* elf)
+{
+    if (!elf || elf->needs_fix || elf->exports)
+        return -1;
+
+    if (snapshot_exports(elf) < 0)
+        return -1;
+
+    // Sections left in place still need the blob, and what
+    //   it takes to restore it on unload
+    int keep_raw = elf->image ? 0 : has_in_place(elf);
+
+    kfree(elf->allocsh);
+    kfree(elf->progmem_shoff);
+    kfree(elf->symhash);
+    kfree(elf->veneer_of);
+
+    elf->allocsh = 0;
+    elf->allocshnum = 0;
+    elf->progmem_shoff = 0;
+    elf->symhash = 0;
+    elf->symhash_mask = 0;
+    elf->sysvhash = 0;
+    elf->veneer_of = 0;
+
+    if (keep_raw)
+        return 0;
+
+    free_rels(elf);
+    kfree(elf->shaddr);
+    elf->shaddr = 0;
+
+    release_tables(elf);
+
+    if (elf->flags & KELF_F_OWNED)
+        kfree(elf->raw);
+
+    elf->raw = 0;
+
+    return 0;
+}
+
 void kelf_unload(struct kelf* elf)
 {
     if (!elf)
@@ -812,6 +2022,9 @@ void kelf_unload(struct kelf* elf)
 
     unload(elf);
 
+    if (elf->flags & KELF_F_OWNED)
+        kfree(elf->raw);
+
     kfree(elf);
 }
 
@@ -820,23 +2033,39 @@ void* kelf_symbol(struct kelf* elf, const char* name)
     if (!elf || !name)
         return 0;
 
-    for (elf32_word i = 0; i < elf->symtab->sh_size / elf->symtab->sh_entsize; ++i)
+    if (elf->exports)
     {
-        elf32_sym* sym = symbol(elf, i);
-        if (!sym)
-            return 0;
-
-        if (strcmp(symbol_name(elf, sym), name) == 0)
+        for (elf32_word i = 0; i < elf->nexports; ++i)
         {
-            elf32_word addr = symbol_addr(elf, sym);
-            if (addr)
-            {
-                if (ELF32_ST_TYPE(sym->st_info) == STT_FUNC)
-                    addr |= 1;
-            }
-            return (void*)addr;
+            if (strcmp(elf->exports[i].name, name) == 0)
+                return elf->exports[i].addr;
         }
+
+        return 0;
     }
 
-    return 0;
+    if (elf->image)
+        return image_symbol(elf, name);
+
+    elf32_sym* sym = find_symbol(elf, name);
+    if (!sym)
+        return 0;
+
+    elf32_word addr = symbol_addr(elf, sym);
+    if (addr)
+    {
+        if (ELF32_ST_TYPE(sym->st_info) == STT_FUNC)
+            addr |= 1;
+    }
+
+    return (void*)addr;
 }
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(kelf_load);
+EXPORT_KSYMBOL(kelf_finalize);
+EXPORT_KSYMBOL(kelf_unload);
+EXPORT_KSYMBOL(kelf_symbol);
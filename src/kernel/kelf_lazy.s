@@ -0,0 +1,80 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+.syntax unified
+.cpu cortex-m4
+.thumb
+.text
+
+///////////////////////////
+//// Module parameters ////
+///////////////////////////
+
+// N/A
+
+////////////////////////////////
+//// Module's sanity checks ////
+////////////////////////////////
+
+// N/A
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! Offset of the value left in r12 by a lazy stub,
+//!   from the start of the stub
+.equ STUB_IP_OFFSET, 12
+
+///////////////////////////////////////
+//// Module's forward declarations ////
+///////////////////////////////////////
+
+.extern kelf_lazy_bind
+
+.global kelf_lazy_resolve
+
+/////////////////////////////////////
+//// Module's internal variables ////
+/////////////////////////////////////
+
+// N/A
+
+/////////////////////////////////////
+//// Module's internal functions ////
+/////////////////////////////////////
+
+// N/A
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+//! Entered from a lazy stub (see kelf.c) on the first call through
+//!   it, with r12 pointing inside the stub : bind the stub's symbol,
+//!   then jump to it with the caller's arguments and return address
+//!   untouched. Six registers are saved to keep the stack 8-byte
+//!   aligned for the C code.
+.type  kelf_lazy_resolve, %function
+kelf_lazy_resolve:
+    push {r0-r3, r12, lr}
+    sub r0, r12, #STUB_IP_OFFSET
+    bl kelf_lazy_bind
+    str r0, [sp, #16] // becomes r12
+    pop {r0-r3, r12, lr}
+    bx r12
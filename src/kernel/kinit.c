@@ -0,0 +1,260 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "kernel/kinit.h"
+#include "kernel/ksymbols.h"
+#include "kernel/ksched.h"
+#include "kernel/kcrit.h"
+#include "kernel/kprint.h"
+
+///////////////////////////
+//// Module parameters ////
+///////////////////////////
+
+//! Number of tasks that can sleep in kinit_wait() at
+//!   the same time, others poll
+#define WAITERS 8
+
+//! Scheduling priority of the init task
+#define INIT_TASK_PRIO KSCHED_PRIO_MIN
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! States of a boot step
+enum
+{
+    //! Not run yet
+    S_PENDING,
+    //! Run successfully
+    S_DONE,
+    //! Failed, or one of its dependencies did
+    S_FAILED
+};
+
+///////////////////////////////////////
+//// Module's forward declarations ////
+///////////////////////////////////////
+
+static void complete(int id, int state);
+static void run_step(int id);
+static void init_task(void* arg);
+
+/////////////////////////////////////
+//// Module's internal variables ////
+/////////////////////////////////////
+
+//! The boot sequence
+static const struct kinit_step* steps = 0;
+
+//! Number of steps in the boot sequence
+static int steps_count = 0;
+
+//! State of each step (see S_*)
+static volatile int states[KINIT_MAX_STEPS];
+
+//! Tasks sleeping until some step is over
+static struct ktask* waiters[WAITERS];
+
+/////////////////////////////////////
+//// Module's internal functions ////
+/////////////////////////////////////
+
+//! Set the final state of a step, and wake up
+//!   the tasks waiting for a step to complete
+//! \param id The step's index
+//! \param state Its final state
+static void complete(int id, int state)
+{
+    uint32_t crit = kcrit_enter();
+
+    states[id] = state;
+
+    // They check again for the step they wait for
+    for (int i = 0; i < WAITERS; ++i)
+    {
+        if (waiters[i])
+            ksched_wakeup(waiters[i]);
+        waiters[i] = 0;
+    }
+
+    kcrit_exit(crit);
+}
+
+//! Run a step, once its dependencies are over
+//! \param id The step's index
+static void run_step(int id)
+{
+    const struct kinit_step* step = steps + id;
+
+    int state = S_DONE;
+    for (int i = 0; i < steps_count; ++i)
+    {
+        if ((step->depends & KINIT_DEP(i)) && states[i] != S_DONE)
+            state = S_FAILED;
+    }
+
+    // Dependencies outside of the table can't be met
+    if (steps_count < KINIT_MAX_STEPS && (step->depends >> steps_count))
+        state = S_FAILED;
+
+    if (state != S_DONE)
+    {
+        kprint(KPRINT_ERR "%s: unmet dependencies\n", step->name);
+    }
+    else if (step->run() < 0)
+    {
+        kprint(KPRINT_ERR "%s: failed\n", step->name);
+        state = S_FAILED;
+    }
+    else
+    {
+        kprint(KPRINT_MSG "%s: done\n", step->name);
+    }
+
+    complete(id, state);
+}
+
+//! Init task main function, runs the deferred steps
+//! \param arg Unused
+static void init_task(void* arg)
+{
+    (void)arg;
+
+    for (int i = 0; i < steps_count; ++i)
+    {
+        if (steps[i].deferred)
+            run_step(i);
+    }
+
+    kprint(KPRINT_MSG "boot sequence over\n");
+}
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+int kinit_run(const struct kinit_step* sequence, int count)
+{
+    if (!sequence || count < 0 || count > KINIT_MAX_STEPS || steps)
+        return -1;
+
+    steps = sequence;
+    steps_count = count;
+
+    int err = 0;
+    int deferred = 0;
+
+    for (int i = 0; i < count; ++i)
+        states[i] = S_PENDING;
+
+    // Deferred steps are still pending, those depending
+    //   on them fail here
+    for (int i = 0; i < count; ++i)
+    {
+        if (steps[i].deferred)
+        {
+            deferred = 1;
+            continue;
+        }
+
+        run_step(i);
+        if (states[i] != S_DONE)
+            err = -1;
+    }
+
+    if (!deferred)
+        return err;
+
+    int pid = ksched_spawn("[kinit]", (void*)&init_task, 0);
+    if (pid < 0 || ksched_set_priority(pid, INIT_TASK_PRIO) < 0)
+    {
+        kprint(KPRINT_ERR "unable to spawn the init task\n");
+
+        for (int i = 0; i < count; ++i)
+        {
+            if (steps[i].deferred)
+                complete(i, S_FAILED);
+        }
+
+        return -1;
+    }
+
+    return err;
+}
+
+int kinit_wait(int step)
+{
+    if (step < 0 || step >= steps_count)
+        return -1;
+
+    // No task to put to sleep
+    if (!ksched_current())
+        return states[step] == S_DONE ? 0 : -1;
+
+    for (;;)
+    {
+        // Checking the state and going to sleep is
+        //   atomic, so that no wakeup can be lost
+        uint32_t crit = kcrit_enter();
+        int state = states[step];
+        int slept = 0;
+
+        if (state == S_PENDING)
+        {
+            for (int i = 0; i < WAITERS && !slept; ++i)
+            {
+                if (!waiters[i])
+                {
+                    waiters[i] = ksched_current();
+                    ksched_sleep();
+                    slept = 1;
+                }
+            }
+        }
+
+        kcrit_exit(crit);
+
+        if (state != S_PENDING)
+            return state == S_DONE ? 0 : -1;
+
+        // Too many waiters, poll
+        if (!slept)
+            ksched_yield();
+    }
+}
+
+int kinit_done(int step)
+{
+    if (step < 0 || step >= steps_count)
+        return -1;
+
+    int state = states[step];
+    if (state == S_PENDING)
+        return 0;
+
+    return state == S_DONE ? 1 : -1;
+}
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(kinit_wait);
+EXPORT_KSYMBOL(kinit_done);
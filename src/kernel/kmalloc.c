@@ -17,6 +17,9 @@
  */
 
 #include "kernel/kmalloc.h"
+#include "kernel/ksymbols.h"
+#include "kernel/kcrit.h"
+#include "kernel/ksched.h"
 
 ///////////////////////////
 //// Module parameters ////
@@ -27,6 +30,9 @@
 // KMALLOC_POOL_DEPTH is defined at compile time
 #define DEPTH KMALLOC_POOL_DEPTH
 
+//! Maximum number of arenas, including the kernel's one
+#define ARENAS 32
+
 ////////////////////////////////
 //// Module's sanity checks ////
 ////////////////////////////////
@@ -39,6 +45,10 @@
 #error "Depth does not guarantee alignment"
 #endif
 
+#if ARENAS > 32
+#error "Arenas are tracked in a 32 bits mask"
+#endif
+
 //////////////////////////////
 //// Module's definitions ////
 //////////////////////////////
@@ -62,6 +72,11 @@ enum
     F_BLOCKED_BY_CHILD = 0x04
 };
 
+//! Used blocks keep the arena they belong to in
+//!   the upper bits of their status
+#define OWNER_SHIFT 8
+#define STATUS_MASK ((1 << OWNER_SHIFT) - 1)
+
 /////////////////////////////////////
 //// Module's internal variables ////
 /////////////////////////////////////
@@ -73,6 +88,12 @@ static int blocks_count[DEPTH];
 //! Array of all block statuses, by global block id.
 static int blocks_statuses[BLOCKS_COUNT];
 
+//! Mask of the arenas in use (the kernel's one, 0, always is)
+static uint32_t arenas_used = 0x01;
+//! Arena new blocks are accounted to, until the scheduler
+//!   is started (each task has its own then)
+static int arena_boot = KMALLOC_ARENA_KERNEL;
+
 /////////////////////////////////////
 //// Module's internal functions ////
 /////////////////////////////////////
@@ -176,7 +197,7 @@ static void find_used(int offset, int* order, int* id, int** status)
         if (!*status)
             return;
 
-        if (**status == F_USED)
+        if ((**status & STATUS_MASK) == F_USED)
         {
             *order = o;
             *id = i;
@@ -187,8 +208,9 @@ static void find_used(int offset, int* order, int* id, int** status)
 
 //! Allocate a block of memory.
 //! \param size The size of the block to allocate, in bytes
+//! \param owner The arena the block belongs to
 //! \return The offset of the alloc'ed block in bytes, or -1 on failure
-static int alloc(int size)
+static int alloc(int size, int owner)
 {
     if (size <= 0 || size > POOL_SIZE)
         return -1;
@@ -229,7 +251,7 @@ static int alloc(int size)
         return -1;
 
     // Tag this block
-    *s = F_USED;
+    *s = F_USED | (owner << OWNER_SHIFT);
 
     // Tag parent and children blocks
     if (mark_children(order, id, F_BLOCKED_BY_PARENT) < 0)
@@ -318,6 +340,15 @@ static void init()
     }
 }
 
+//! Get the arena in use for the running task
+//! \return A pointer to the arena's identifier
+static int* arena_current()
+{
+    struct ktask* task = ksched_current();
+
+    return task ? &task->arena : &arena_boot;
+}
+
 //! Print out the allocator's state.
 static void __attribute__((unused)) dump(void (*debug)(const char*, ...))
 {
@@ -337,7 +368,7 @@ static void __attribute__((unused)) dump(void (*debug)(const char*, ...))
 
             if (*s == F_FREE)
                 (*debug)("F");
-            else if (*s == F_USED)
+            else if ((*s & STATUS_MASK) == F_USED)
                 (*debug)("U");
             else if (*s == F_BLOCKED_BY_CHILD)
                 (*debug)("C");
@@ -365,7 +396,10 @@ int kmalloc_init()
 
 void* kmalloc(int size)
 {
-    int offset = alloc(size);
+    uint32_t crit = kcrit_enter();
+    int offset = alloc(size, *arena_current());
+    kcrit_exit(crit);
+
     if (offset < 0)
         return 0;
 
@@ -377,37 +411,42 @@ void* krealloc(void* ptr, int size)
     if (!size)
         return 0;
 
-    // Try to allocate the new buffer
-    void* new_buf = kmalloc(size);
-    if (!new_buf)
-        return 0;
+    if (!ptr)
+        return kmalloc(size);
 
-    if (ptr)
-    {
-        int offset = (int)(ptr - kmalloc_pool);
+    int offset = (int)(ptr - kmalloc_pool);
+
+    // Seek for the used block mapped to this offset
+    int order = -1;
+    int id = -1;
+    int* s;
+    uint32_t crit = kcrit_enter();
+    find_used(offset, &order, &id, &s);
 
-        // Seek for the used block mapped to this offset
-        int order = -1;
-        int id = -1;
-        int* s;
-        find_used(offset, &order, &id, &s);
+    // The new buffer stays in the old one's arena
+    int new_offset = (order < 0 || id < 0) ? -1 : alloc(size, *s >> OWNER_SHIFT);
+    kcrit_exit(crit);
 
-        // We never alloc'ed this block !
-        if (order < 0 || id < 0)
-            return 0;
+    // We never alloc'ed this block, or there is no room
+    if (new_offset < 0)
+        return 0;
 
-        // Get the old buffer's size
-        int old_size = blocks_size[order];
+    void* new_buf = kmalloc_pool + new_offset;
 
-        // Copy data in the new buffer
-        int min_size = old_size < size ? old_size : size;
-        for (int i = 0; i < min_size; ++i)
-            *((char*)new_buf + i) = *((char*)ptr + i);
+    // Get the old buffer's size
+    int old_size = blocks_size[order];
 
-        // Release the old buffer
-        if (release(offset) < 0)
-            return 0;
-    }
+    // Copy data in the new buffer
+    int min_size = old_size < size ? old_size : size;
+    for (int i = 0; i < min_size; ++i)
+        *((char*)new_buf + i) = *((char*)ptr + i);
+
+    // Release the old buffer
+    crit = kcrit_enter();
+    int err = release(offset);
+    kcrit_exit(crit);
+    if (err < 0)
+        return 0;
 
     return new_buf;
 }
@@ -418,5 +457,97 @@ void kfree(void* ptr)
         return;
 
     int offset = (int)(ptr - kmalloc_pool);
+
+    uint32_t crit = kcrit_enter();
     release(offset);
+    kcrit_exit(crit);
+}
+
+int kmalloc_arena_create()
+{
+    int arena = -1;
+    uint32_t crit = kcrit_enter();
+
+    for (int i = 1; i < ARENAS; ++i)
+    {
+        if (!(arenas_used & (1u << i)))
+        {
+            arenas_used |= 1u << i;
+            arena = i;
+            break;
+        }
+    }
+
+    kcrit_exit(crit);
+
+    return arena;
 }
+
+int kmalloc_arena_use(int arena)
+{
+    if (arena < 0 || arena >= ARENAS)
+        return -1;
+
+    uint32_t crit = kcrit_enter();
+
+    int previous = -1;
+    if (arenas_used & (1u << arena))
+    {
+        previous = *arena_current();
+        *arena_current() = arena;
+    }
+
+    kcrit_exit(crit);
+
+    return previous;
+}
+
+int kmalloc_arena_current()
+{
+    return *arena_current();
+}
+
+int kmalloc_arena_release(int arena)
+{
+    if (arena <= KMALLOC_ARENA_KERNEL || arena >= ARENAS)
+        return -1;
+
+    int freed = 0;
+    uint32_t crit = kcrit_enter();
+
+    // Tasks allocating from it would be left with dangling memory
+    if (!(arenas_used & (1u << arena)) || *arena_current() == arena ||
+        ksched_arena_tasks(arena) > 0)
+    {
+        kcrit_exit(crit);
+        return -1;
+    }
+
+    // Releasing a block only changes the status of its parents
+    //   and children, which are not used blocks
+    for (int o = 0; o < DEPTH; ++o)
+    {
+        for (int i = 0; i < blocks_count[o]; ++i)
+        {
+            if (*block_status(o, i) != (F_USED | (arena << OWNER_SHIFT)))
+                continue;
+
+            if (release(i * blocks_size[o]) == 0)
+                ++freed;
+        }
+    }
+
+    arenas_used &= ~(1u << arena);
+
+    kcrit_exit(crit);
+
+    return freed;
+}
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(kmalloc);
+EXPORT_KSYMBOL(krealloc);
+EXPORT_KSYMBOL(kfree);
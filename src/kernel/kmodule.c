@@ -17,9 +17,13 @@
  */
 
 #include "kernel/kmodule.h"
+#include "kernel/ksymbols.h"
 #include "kernel/kmalloc.h"
+#include "kernel/kcrit.h"
 #include "kernel/kprint.h"
 #include "kernel/kelf.h"
+#include "kernel/ktime.h"
+#include "kernel/ksched.h"
 #include "kernel/fs/vfs.h"
 #include <string.h>
 
@@ -27,7 +31,13 @@
 //// Module parameters ////
 ///////////////////////////
 
-// N/A
+//! Where module files are looked for, and their extension
+#define MODULES_DIR "/initrd/modules/"
+#define MODULES_EXT ".ko"
+
+// Define KMODULE_LAZY_BINDING (add -DKMODULE_LAZY_BINDING to the
+//   Makefile DEFINES) to bind the functions modules import from the
+//   kernel lazily, on their first call (see KELF_F_LAZY)
 
 ////////////////////////////////
 //// Module's sanity checks ////
@@ -42,6 +52,9 @@
 struct kmodule
 {
     kelf* elf;
+    //! The kmalloc arena holding everything the
+    //!   module allocated
+    int arena;
 
     const char* name;
     int* ver;
@@ -55,6 +68,30 @@ struct kmodule
     kmodule* next;
 };
 
+//! States of a module in a batch (see kmodule_insert_set())
+enum
+{
+    //! Read, waiting for its dependencies to be sorted
+    BATCH_READ,
+    //! Sorted after all its dependencies
+    BATCH_SORTED,
+    //! Not inserted, and released
+    BATCH_FAILED
+};
+
+//! A module being inserted by kmodule_insert_set()
+struct batch_entry
+{
+    kmodule* mod;
+    //! State of the module (see BATCH_*)
+    int state;
+    //! Time spent reading, linking and initializing
+    //!   the module, in cycles
+    uint32_t read;
+    uint32_t link;
+    uint32_t init;
+};
+
 ///////////////////////////////////////
 //// Module's forward declarations ////
 ///////////////////////////////////////
@@ -83,6 +120,10 @@ static int module_list_add(kmodule* mod)
     if (!mod)
         return -1;
 
+    mod->next = 0;
+
+    uint32_t crit = kcrit_enter();
+
     if (!module_list_last)
     {
         module_list_first = module_list_last = mod;
@@ -93,7 +134,7 @@ static int module_list_add(kmodule* mod)
         module_list_last = mod;
     }
 
-    mod->next = 0;
+    kcrit_exit(crit);
 
     return 0;
 }
@@ -106,6 +147,9 @@ static int module_list_remove(kmodule* mod)
     if (!mod)
         return -1;
 
+    int err = -1;
+    uint32_t crit = kcrit_enter();
+
     kmodule* last = 0;
     for (kmodule* m = module_list_first; m; last = m, m = m->next)
     {
@@ -123,11 +167,14 @@ static int module_list_remove(kmodule* mod)
                 last->next = m->next;
 
             m->next = 0;
-            return 0;
+            err = 0;
+            break;
         }
     }
 
-    return -1;
+    kcrit_exit(crit);
+
+    return err;
 }
 
 //! Find a module by name in the list
@@ -138,13 +185,35 @@ static kmodule* module_list_by_name(const char* name)
     if (!name)
         return 0;
 
+    kmodule* found = 0;
+    uint32_t crit = kcrit_enter();
+
     for (kmodule* m = module_list_first; m; m = m->next)
     {
         if (strcmp(m->name, name) == 0)
-            return m;
+        {
+            found = m;
+            break;
+        }
     }
 
-    return 0;
+    kcrit_exit(crit);
+
+    return found;
+}
+
+//! Read a module file for the streaming elf loader
+//!   (see struct kelf_reader)
+//! \param ctx The file's inode
+//! \param offset Offset in the file
+//! \param buf The destination buffer
+//! \param size Number of bytes to read
+//! \return 0 if all bytes were read, -1 otherwise
+static int read_inode(void* ctx, uint32_t offset, void* buf, uint32_t size)
+{
+    int read = vfs_read((struct inode*)ctx, (int)offset, buf, (int)size);
+
+    return (read == (int)size) ? 0 : -1;
 }
 
 //! Get the module's needed symbol's addresses
@@ -179,8 +248,30 @@ int insert_raw(kmodule* mod)
     if (!mod || !mod->init)
         return -1;
 
-    if (mod->init() < 0)
+    int arena = kmalloc_arena_use(mod->arena);
+    int err = mod->init();
+    kmalloc_arena_use(arena);
+
+    return err < 0 ? -1 : 0;
+}
+
+//! Reclaim everything a module owns : its symbols, code and
+//!   allocations. Nothing is reclaimed while tasks it spawned
+//!   are still alive, as they run its code
+//! \param mod The module to release
+//! \return 0 if OK, -1 otherwise
+static int discard(kmodule* mod)
+{
+    if (ksched_arena_tasks(mod->arena) > 0)
+    {
+        kprint(KPRINT_ERR "    module '%s' kept in memory: its tasks are still running\n", mod->name);
         return -1;
+    }
+
+    ksymbol_remove_arena(mod->arena);
+    kelf_unload(mod->elf);
+    kmalloc_arena_release(mod->arena);
+    kfree(mod);
 
     return 0;
 }
@@ -194,45 +285,192 @@ int remove_raw(kmodule* mod)
     if (!mod || !mod->fini)
         return -1;
 
+    int arena = kmalloc_arena_use(mod->arena);
     int err = mod->fini();
-    kfree(mod);
+    kmalloc_arena_use(arena);
+
+    // Reclaim everything the module left behind
+    if (discard(mod) < 0)
+        return -1;
 
     return err < 0 ? -1 : 0;
 }
 
-//! Insert a module into the kernel, checking its dependencies
-//!   (and optionnally inserting them)
-//! \param elf The elf blob to insert
-//! \param load_dependencies Also load the
-//!        (eventually) needed dependencies
-kmodule* insert(kelf* elf, int load_dependencies)
+//! Read a module's file and load it in its own arena
+//! \param name The name of the module
+//! \param path The path buffer, grown as needed (to
+//!        be freed by the caller)
+//! \param path_size The path buffer's size
+//! \return The module, not linked yet, 0 upon failure
+static kmodule* open_module(const char* name, char** path, int* path_size)
 {
+    int size = strlen(MODULES_DIR) + strlen(name) + strlen(MODULES_EXT) + 1;
+    if (size > *path_size)
+    {
+        char* p = krealloc(*path, size);
+        if (!p)
+        {
+            kprint(KPRINT_ERR "    failed to load module '%s': kmalloc error\n", name);
+            return 0;
+        }
+
+        *path = p;
+        *path_size = size;
+    }
+
+    strcpy(*path, MODULES_DIR);
+    strcat(*path, name);
+    strcat(*path, MODULES_EXT);
+
+    struct inode* in = vfs_find(*path);
+    if (!in)
+    {
+        kprint(KPRINT_ERR "    failed to load module '%s': file '%s' does not exists\n", name, *path);
+        return 0;
+    }
+
+    // Everything the module allocates is accounted in its own arena
+    int arena = kmalloc_arena_create();
+    if (arena < 0)
+    {
+        kprint(KPRINT_ERR "    failed to load module '%s': too many modules\n", name);
+        return 0;
+    }
+
+    int flags = 0;
+
+#ifdef KMODULE_LAZY_BINDING
+    flags |= KELF_F_LAZY;
+#endif
+
+    kelf* elf = 0;
+    char* data;
+    int data_size;
+    int previous = kmalloc_arena_use(arena);
+
+    // Blobs living in RAM are executed in place, only their
+    //   writable sections get copied
+    if (vfs_rawptr(in, (void**)&data, &data_size) == 0 && data)
+    {
+        if (in->superblock->flags & FSF_RAM)
+            flags |= KELF_F_XIP;
+
+        elf = kelf_load(data, flags);
+    }
+    // Other files are streamed, without ever holding
+    //   them whole in memory
+    else if (in->superblock->read)
+    {
+        struct kelf_reader reader = { &read_inode, in };
+        elf = kelf_load_stream(&reader, flags);
+    }
+
+    kmalloc_arena_use(previous);
+
     if (!elf)
+    {
+        kprint(KPRINT_ERR "    failed to load module '%s': ELF error\n", name);
+        kmalloc_arena_release(arena);
         return 0;
+    }
 
-    // Allocate memory
     kmodule* mod = kmalloc(sizeof(struct kmodule));
     if (!mod)
+    {
+        kelf_unload(elf);
+        kmalloc_arena_release(arena);
         return 0;
+    }
     mod->elf = elf;
+    mod->arena = arena;
 
     // Resolve mandatory module symbols
     if (get_symbols(mod) < 0)
     {
-        kprint(KPRINT_ERR "    module '%s' not loaded: malformed symbols\n", mod->name);
-        kelf_unload(mod->elf);
-        kfree(mod);
+        kprint(KPRINT_ERR "    module '%s' not loaded: malformed symbols\n", name);
+        discard(mod);
         return 0;
     }
 
+    return mod;
+}
+
+//! Link a module once its dependencies are inserted : resolve
+//!   its remaining relocations and drop the loader's tables.
+//!   The module is discarded upon failure.
+//! \param mod The module to link
+//! \return 0 if OK, -1 otherwise
+static int link_module(kmodule* mod)
+{
+    if (kelf_needs_fix(mod->elf))
+    {
+        if (kelf_fix_relocations(mod->elf) < 0)
+        {
+            kprint(KPRINT_ERR "    module '%s' not loaded: unsatisfied relocations\n", mod->name);
+            discard(mod);
+            return -1;
+        }
+
+        get_symbols(mod);
+    }
+
+    // Loading is over, drop the loader's tables (the table
+    //   of exports left belongs to the module)
+    int previous = kmalloc_arena_use(mod->arena);
+    int err = kelf_finalize(mod->elf);
+    kmalloc_arena_use(previous);
+
+    if (err < 0)
+    {
+        kprint(KPRINT_ERR "    module '%s' not loaded: unable to finalize\n", mod->name);
+        discard(mod);
+        return -1;
+    }
+
+    return 0;
+}
+
+//! Initialize a linked module and add it to the list.
+//!   The module is discarded upon failure.
+//! \param mod The module to start
+//! \return 0 if OK, -1 otherwise
+static int start_module(kmodule* mod)
+{
+    if (insert_raw(mod) < 0)
+    {
+        kprint(KPRINT_ERR "    module '%s' not loaded: internal error\n", mod->name);
+        discard(mod);
+        return -1;
+    }
+
+    if (module_list_add(mod) < 0)
+    {
+        kprint(KPRINT_ERR "    module '%s' not loaded: unable to add to list\n", mod->name);
+        discard(mod);
+        return -1;
+    }
+
+    kprint(KPRINT_TRACE "    loaded module '%s'\n", mod->name);
+    return 0;
+}
+
+//! Insert a module into the kernel, checking its dependencies
+//!   (and optionnally inserting them)
+//! \param mod The module to insert (see open_module())
+//! \param load_dependencies Also load the
+//!        (eventually) needed dependencies
+kmodule* insert(kmodule* mod, int load_dependencies)
+{
+    if (!mod)
+        return 0;
+
     // Dependency checking
     for (int i = 0; i < *mod->depends_size; ++i)
     {
         const char* dep = mod->depends[i];
         if (!dep)
         {
-            kelf_unload(mod->elf);
-            kfree(mod);
+            discard(mod);
             return 0;
         }
 
@@ -260,44 +498,100 @@ kmodule* insert(kelf* elf, int load_dependencies)
             if (err)
             {
                 kprint(KPRINT_ERR "    module '%s' not loaded: unresolved dependency '%s'\n", mod->name, dep);
-                kelf_unload(mod->elf);
-                kfree(mod);
+                discard(mod);
                 return 0;
             }
         }
     }
 
-    if (kelf_needs_fix(mod->elf))
-    {
-        if (kelf_fix_relocations(mod->elf) < 0)
-        {
-            kprint(KPRINT_ERR "    module '%s' not loaded: unsatisfied relocations\n", mod->name);
-            kelf_unload(mod->elf);
-            kfree(mod);
-            return 0;
-        }
+    if (link_module(mod) < 0 || start_module(mod) < 0)
+        return 0;
 
-        get_symbols(mod);
-    }
+    return mod;
+}
 
-    if (insert_raw(mod) < 0)
+//! Find a module by name in a batch
+//! \param set The batch
+//! \param count Number of modules in the batch
+//! \param name The name to find
+//! \return The module's index, -1 if not found
+static int batch_find(struct batch_entry* set, int count, const char* name)
+{
+    for (int i = 0; i < count; ++i)
     {
-        kprint(KPRINT_ERR "    module '%s' not loaded: internal error\n", mod->name);
-        kelf_unload(mod->elf);
-        kfree(mod);
-        return 0;
+        // (failed modules are gone)
+        if (set[i].mod && strcmp(set[i].mod->name, name) == 0)
+            return i;
     }
 
-    if (module_list_add(mod) < 0)
+    return -1;
+}
+
+//! Read a module and add it to a batch
+//! \param set The batch, grown as needed
+//! \param count Number of modules in the batch
+//! \param name The name of the module
+//! \param path The path buffer (see open_module())
+//! \param path_size The path buffer's size
+//! \return 0 if OK, -1 otherwise
+static int batch_add(struct batch_entry** set, int* count, const char* name, char** path, int* path_size)
+{
+    struct batch_entry* s = krealloc(*set, (*count + 1) * sizeof(struct batch_entry));
+    if (!s)
+        return -1;
+    *set = s;
+
+    uint32_t start = ktime_cycles();
+    kmodule* mod = open_module(name, path, path_size);
+    if (!mod)
+        return -1;
+
+    s[*count].mod = mod;
+    s[*count].state = BATCH_READ;
+    s[*count].read = ktime_cycles() - start;
+    s[*count].link = 0;
+    s[*count].init = 0;
+    ++*count;
+
+    return 0;
+}
+
+//! Get the state a module of a batch can move to, from the
+//!   state of its dependencies
+//! \param set The batch
+//! \param count Number of modules in the batch
+//! \param id The module's index
+//! \return BATCH_SORTED if all dependencies are inserted or
+//!         sorted before it, BATCH_FAILED if one of them
+//!         can't be, BATCH_READ if it has to wait
+static int batch_deps_state(struct batch_entry* set, int count, int id)
+{
+    kmodule* mod = set[id].mod;
+    int state = BATCH_SORTED;
+
+    for (int i = 0; i < *mod->depends_size; ++i)
     {
-        kprint(KPRINT_ERR "    module '%s' not loaded: unable to add to list\n", mod->name);
-        kelf_unload(mod->elf);
-        kfree(mod);
-        return 0;
+        const char* dep = mod->depends[i];
+        if (!dep)
+            return BATCH_FAILED;
+
+        int d = batch_find(set, count, dep);
+        if (d < 0)
+        {
+            if (!module_list_by_name(dep))
+                return BATCH_FAILED;
+        }
+        else if (set[d].state == BATCH_FAILED)
+        {
+            return BATCH_FAILED;
+        }
+        else if (set[d].state != BATCH_SORTED)
+        {
+            state = BATCH_READ;
+        }
     }
 
-    kprint(KPRINT_TRACE "    loaded module '%s'\n", mod->name);
-    return mod;
+    return state;
 }
 
 //! Remove a module from the kernel
@@ -306,6 +600,14 @@ int remove(kmodule* mod, int unload_dependencies)
     if (!mod)
         return -1;
 
+    // Its code can't go away under its tasks, so leave it
+    //   loaded (and not finalized) while any is alive
+    if (ksched_arena_tasks(mod->arena) > 0)
+    {
+        kprint(KPRINT_ERR "    failed to unload module '%s': its tasks are still running\n", mod->name);
+        return -1;
+    }
+
     // Find all reverse dependencies
     for (kmodule* m = module_list_first; m; m = m->next)
     {
@@ -348,14 +650,15 @@ int remove(kmodule* mod, int unload_dependencies)
         return -1;
     }
 
-    // Unload module
+    // Unload module, its name goes away with it
+    kprint(KPRINT_TRACE "    unloading module '%s'\n", mod->name);
     if (remove_raw(mod) < 0)
     {
-        kprint(KPRINT_ERR "    failed to unload module '%s': internal error\n", mod->name);
+        kprint(KPRINT_ERR "    failed to unload module: internal error\n");
         return -1;
     }
 
-    kprint(KPRINT_TRACE "    module '%s' unloaded\n", mod->name);
+    kprint(KPRINT_TRACE "    module unloaded\n");
     return 0;
 }
 
@@ -365,49 +668,156 @@ int remove(kmodule* mod, int unload_dependencies)
 
 kmodule* kmodule_insert(const char* name, int load_dependencies)
 {
-    char* data;
-    int size;
-
     kprint(KPRINT_TRACE "=== loading module '%s'\n", name);
 
-    const char* folder = "/initrd/modules/";
-    const char* ext = ".ko";
-    char* path = kmalloc(strlen(folder) + strlen(name) + strlen(ext) + 1);
-    if (!path)
+    char* path = 0;
+    int path_size = 0;
+
+    kmodule* mod = open_module(name, &path, &path_size);
+    kfree(path);
+
+    if (mod)
+        mod = insert(mod, load_dependencies);
+
+    kprint(KPRINT_TRACE "=== done\n");
+    return mod;
+}
+
+int kmodule_insert_set(const char** names, int count)
+{
+    if (!names || count < 0)
+        return -1;
+
+    kprint(KPRINT_TRACE "=== loading %d modules\n", count);
+
+    struct batch_entry* set = 0;
+    int size = 0;
+    char* path = 0;
+    int path_size = 0;
+    int err = 0;
+
+    // Read the requested modules...
+    for (int i = 0; i < count; ++i)
     {
-        kprint(KPRINT_ERR "    failed to load module '%s': kmalloc error", name);
-        return 0;
+        if (module_list_by_name(names[i]) || batch_find(set, size, names[i]) >= 0)
+            continue;
+
+        if (batch_add(&set, &size, names[i], &path, &path_size) < 0)
+            err = -1;
+    }
+
+    // ... and their dependencies (the batch grows meanwhile)
+    for (int i = 0; i < size; ++i)
+    {
+        kmodule* mod = set[i].mod;
+
+        for (int j = 0; j < *mod->depends_size; ++j)
+        {
+            const char* dep = mod->depends[j];
+            if (!dep || module_list_by_name(dep) || batch_find(set, size, dep) >= 0)
+                continue;
+
+            kprint(KPRINT_TRACE "    loading dependency '%s'\n", dep);
+            if (batch_add(&set, &size, dep, &path, &path_size) < 0)
+                err = -1;
+        }
     }
 
-    strcpy(path, folder);
-    strcpy(path + strlen(folder), name);
-    strcpy(path + strlen(folder) + strlen(name), ext);
-    path[strlen(folder) + strlen(name) + strlen(ext)] = '\0';
+    kfree(path);
 
-    struct inode* in = vfs_find(path);
-    if (!in)
+    // Sort them so that each module comes after its dependencies,
+    //   what is left unsorted is part of a cycle
+    int* order = kmalloc((size ? size : 1) * sizeof(int));
+    int sorted = 0;
+
+    for (int progress = 1; order && progress;)
     {
-        kprint(KPRINT_ERR "    failed to load module '%s': file '%s' does not exists\n", name, path);
-        return 0;
+        progress = 0;
+
+        for (int i = 0; i < size; ++i)
+        {
+            if (set[i].state != BATCH_READ)
+                continue;
+
+            int state = batch_deps_state(set, size, i);
+            if (state == BATCH_READ)
+                continue;
+
+            set[i].state = state;
+            if (state == BATCH_SORTED)
+                order[sorted++] = i;
+
+            progress = 1;
+        }
     }
 
-    if (vfs_rawptr(in, (void**)&data, &size) < 0 || !*data)
+    for (int i = 0; i < size; ++i)
     {
-        kprint(KPRINT_ERR "    failed to load module '%s': unable to read '%s'\n", name, path);
-        return 0;
+        if (set[i].state == BATCH_SORTED)
+            continue;
+
+        kprint(KPRINT_ERR "    module '%s' not loaded: unresolved dependencies\n", set[i].mod->name);
+        discard(set[i].mod);
+        set[i].mod = 0;
+        set[i].state = BATCH_FAILED;
+        err = -1;
     }
 
-    kelf* elf = kelf_load(data);
-    if (!elf)
+    // Dependencies are initialized first, so the symbols they
+    //   export are there when a module gets linked : each one
+    //   needs a single relocation pass
+    for (int k = 0; k < sorted; ++k)
     {
-        kprint(KPRINT_ERR "    failed to load module '%s': ELF error\n", name);
-        return 0;
+        struct batch_entry* e = set + order[k];
+
+        // A dependency failed to link or start
+        if (batch_deps_state(set, size, order[k]) != BATCH_SORTED)
+        {
+            kprint(KPRINT_ERR "    module '%s' not loaded: unresolved dependencies\n", e->mod->name);
+            discard(e->mod);
+            e->mod = 0;
+            e->state = BATCH_FAILED;
+            err = -1;
+            continue;
+        }
+
+        const char* name = e->mod->name;
+
+        uint32_t start = ktime_cycles();
+        if (link_module(e->mod) < 0)
+        {
+            e->mod = 0;
+            e->state = BATCH_FAILED;
+            err = -1;
+            continue;
+        }
+
+        uint32_t linked = ktime_cycles();
+        if (start_module(e->mod) < 0)
+        {
+            e->mod = 0;
+            e->state = BATCH_FAILED;
+            err = -1;
+            continue;
+        }
+
+        e->link = linked - start;
+        e->init = ktime_cycles() - linked;
+
+        kprint(KPRINT_TRACE "    '%s': read %u us, link %u us, init %u us\n", name,
+               (unsigned int)(ktime_cycles_to_ns(e->read) / 1000),
+               (unsigned int)(ktime_cycles_to_ns(e->link) / 1000),
+               (unsigned int)(ktime_cycles_to_ns(e->init) / 1000));
     }
 
-    kmodule* mod = insert(elf, load_dependencies);
+    if (!order)
+        err = -1;
+
+    kfree(order);
+    kfree(set);
 
     kprint(KPRINT_TRACE "=== done\n");
-    return mod;
+    return err;
 }
 
 int kmodule_remove(const char* name, int unload_dependencies)
@@ -429,3 +839,11 @@ int kmodule_remove(const char* name, int unload_dependencies)
     kprint(KPRINT_TRACE "=== done\n");
     return ok;
 }
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(kmodule_insert);
+EXPORT_KSYMBOL(kmodule_insert_set);
+EXPORT_KSYMBOL(kmodule_remove);
@@ -17,6 +17,7 @@
  */
 
 #include "kernel/kprint.h"
+#include "kernel/ksymbols.h"
 #include "platform.h"
 #include <stdarg.h>
 #include <string.h>
@@ -326,3 +327,9 @@ void kprint(const char* fmt, ...)
     itm_vsprintf(0, fmt, ap);
     va_end(ap);
 }
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(kprint);
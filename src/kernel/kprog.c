@@ -0,0 +1,714 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "kernel/kprog.h"
+#include "kernel/ksymbols.h"
+#include "kernel/kmalloc.h"
+#include "kernel/kcrit.h"
+#include "kernel/kprint.h"
+#include "kernel/ksched.h"
+#include "kernel/ktimer.h"
+#include "kernel/elf32.h"
+#include "kernel/fs/vfs.h"
+#include <string.h>
+
+///////////////////////////
+//// Module parameters ////
+///////////////////////////
+
+//! Period (in ticks) at which an exited program checks
+//!   if the tasks it spawned are gone
+#define CHILDREN_POLL_PERIOD 10
+
+////////////////////////////////
+//// Module's sanity checks ////
+////////////////////////////////
+
+#if CHILDREN_POLL_PERIOD <= 0
+#error "CHILDREN_POLL_PERIOD must be strictly positive"
+#endif
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! A program's image, shared by all its instances. Addresses
+//!   are link-time ones, the segments are placed independently
+//!   so that each instance only differs by its data segment.
+struct image
+{
+    //! Path of the executable file
+    char* path;
+    //! Number of running instances
+    int refs;
+    //! The kmalloc arena holding the image
+    int arena;
+
+    //! Read-only segment (code, constants and relocations)
+    const char* text;
+    elf32_addr text_vaddr;
+    elf32_word text_size;
+
+    //! Initial contents of the data segment, and its
+    //!   sizes in the file and in memory
+    const char* data;
+    elf32_addr data_vaddr;
+    elf32_word data_filesz;
+    elf32_word data_memsz;
+
+    //! Dynamic relocations, all of them targeting
+    //!   the data segment
+    const elf32_rel* rels;
+    int rels_count;
+
+    //! Entry point and global offset table
+    elf32_addr entry;
+    elf32_addr got;
+
+    struct image* next;
+};
+
+//! A running instance of a program
+struct instance
+{
+    struct image* img;
+    //! The kmalloc arena holding everything the
+    //!   instance allocated, including itself
+    int arena;
+
+    void* entry;
+    void* pic_base;
+    void* arg;
+};
+
+//! Where an image is read from
+struct source
+{
+    struct inode* in;
+    //! The file's data if it can be accessed directly
+    const char* raw;
+    uint32_t raw_size;
+    //! Set when the file's data can be executed in place
+    int xip;
+};
+
+///////////////////////////////////////
+//// Module's forward declarations ////
+///////////////////////////////////////
+
+// Defined in kprog_entry.s
+void kprog_call(void* arg, void* entry, void* pic_base);
+
+static void wake(void* arg);
+static void wait_children(int arena);
+
+/////////////////////////////////////
+//// Module's internal variables ////
+/////////////////////////////////////
+
+//! Loaded images, in no particular order
+static struct image* images = 0;
+
+/////////////////////////////////////
+//// Module's internal functions ////
+/////////////////////////////////////
+
+//! Read a part of a file
+//! \param src The file
+//! \param offset Offset to read from
+//! \param buf Buffer to read into
+//! \param size Number of bytes to read
+//! \return 0 if OK, -1 otherwise
+static int read_at(struct source* src, uint32_t offset, void* buf, uint32_t size)
+{
+    if (src->raw)
+    {
+        if (offset > src->raw_size || size > src->raw_size - offset)
+            return -1;
+
+        memcpy(buf, src->raw + offset, size);
+        return 0;
+    }
+
+    return (vfs_read(src->in, (int)offset, buf, (int)size) == (int)size) ? 0 : -1;
+}
+
+//! Get a part of a file in memory, in place if possible, or
+//!   in a copy allocated in the current arena otherwise
+//! \param src The file
+//! \param offset Offset of the part
+//! \param size Size of the part (not null)
+//! \return The part's data, 0 if error(s) occured
+static const char* map(struct source* src, uint32_t offset, uint32_t size)
+{
+    if (src->xip)
+    {
+        if (offset > src->raw_size || size > src->raw_size - offset)
+            return 0;
+
+        return src->raw + offset;
+    }
+
+    char* buf = kmalloc(size);
+    if (!buf)
+        return 0;
+
+    if (read_at(src, offset, buf, size) < 0)
+    {
+        kfree(buf);
+        return 0;
+    }
+
+    return buf;
+}
+
+//! Find where some bytes of the program lie in its file
+//! \param phdrs The program headers
+//! \param count Number of program headers
+//! \param vaddr Link-time address of the bytes
+//! \param size Number of bytes
+//! \param offset Output parameter for the file offset
+//! \return 0 if OK, -1 if the bytes are not all in the file
+static int file_offset(const elf32_phdr* phdrs, int count, elf32_addr vaddr, elf32_word size, elf32_off* offset)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        const elf32_phdr* ph = &phdrs[i];
+        if (ph->p_type != PT_LOAD || vaddr < ph->p_vaddr)
+            continue;
+
+        elf32_word delta = vaddr - ph->p_vaddr;
+        if (delta > ph->p_filesz || size > ph->p_filesz - delta)
+            continue;
+
+        *offset = ph->p_offset + delta;
+        return 0;
+    }
+
+    return -1;
+}
+
+//! Relocate a link-time address for an instance. Addresses
+//!   are kept inclusive of the segments' ends so that
+//!   end-of-array pointers are valid.
+//! \param img The program's image
+//! \param data The instance's data segment
+//! \param addr The address to relocate
+//! \param out Output parameter for the relocated address
+//! \return 0 if OK, -1 if the address is in no segment
+static int relocate(struct image* img, char* data, elf32_addr addr, elf32_addr* out)
+{
+    if (addr >= img->data_vaddr && addr - img->data_vaddr <= img->data_memsz)
+    {
+        *out = (elf32_addr)data + (addr - img->data_vaddr);
+        return 0;
+    }
+
+    if (addr >= img->text_vaddr && addr - img->text_vaddr <= img->text_size)
+    {
+        *out = (elf32_addr)img->text + (addr - img->text_vaddr);
+        return 0;
+    }
+
+    return -1;
+}
+
+//! Check the relocations of an image once and for all, so
+//!   that instantiating it can't fail on them
+//! \param img The image
+//! \return 0 if OK, -1 otherwise
+static int check_rels(struct image* img)
+{
+    for (int i = 0; i < img->rels_count; ++i)
+    {
+        const elf32_rel* rel = &img->rels[i];
+        int type = ELF32_R_TYPE(rel->r_info);
+
+        if (type == R_ARM_NONE)
+            continue;
+
+        // Anything else would need a symbol, which static
+        //   executables can't import
+        if (type != R_ARM_RELATIVE)
+            return -1;
+
+        elf32_word at = rel->r_offset - img->data_vaddr;
+        if (rel->r_offset < img->data_vaddr || at % 4 || at >= img->data_memsz || img->data_memsz - at < 4)
+            return -1;
+
+        // Relocate the initial value with a dummy data segment
+        elf32_addr addr = 0;
+        if (at < img->data_filesz)
+            memcpy(&addr, img->data + at, sizeof(elf32_addr));
+
+        elf32_addr unused;
+        if (relocate(img, 0, addr, &unused) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+//! Read the dynamic section of an image
+//! \param img The image to complete
+//! \param src The image's file
+//! \param dyn The PT_DYNAMIC program header
+//! \param phdrs The program headers
+//! \param count Number of program headers
+//! \return 0 if OK, -1 otherwise
+static int read_dynamic(struct image* img, struct source* src, const elf32_phdr* dyn, const elf32_phdr* phdrs, int count)
+{
+    elf32_addr rel = 0;
+    elf32_word relsz = 0;
+    elf32_word relent = sizeof(elf32_rel);
+
+    for (elf32_word i = 0; i < dyn->p_filesz / sizeof(elf32_dyn); ++i)
+    {
+        elf32_dyn entry;
+        if (read_at(src, dyn->p_offset + i * sizeof(elf32_dyn), &entry, sizeof(elf32_dyn)) < 0)
+            return -1;
+
+        if (entry.d_tag == DT_NULL)
+            break;
+
+        switch (entry.d_tag)
+        {
+            // There is no dynamic linker
+            case DT_NEEDED:
+            case DT_TEXTREL:
+            case DT_RELA:
+            case DT_JMPREL:
+                return -1;
+
+            case DT_PLTGOT:
+                img->got = entry.d_val;
+                break;
+
+            case DT_REL:
+                rel = entry.d_val;
+                break;
+
+            case DT_RELSZ:
+                relsz = entry.d_val;
+                break;
+
+            case DT_RELENT:
+                relent = entry.d_val;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    if (relsz)
+    {
+        elf32_off offset;
+        if (relent != sizeof(elf32_rel) || relsz % relent || file_offset(phdrs, count, rel, relsz, &offset) < 0)
+            return -1;
+
+        img->rels = (const elf32_rel*)map(src, offset, relsz);
+        if (!img->rels)
+            return -1;
+        img->rels_count = relsz / relent;
+    }
+
+    return 0;
+}
+
+//! Parse an executable file into an image
+//! \param img The image to fill
+//! \param src The executable file
+//! \return 0 if OK, -1 otherwise
+static int parse(struct image* img, struct source* src)
+{
+    elf32_header header;
+    if (read_at(src, 0, &header, sizeof(elf32_header)) < 0)
+        return -1;
+
+    if (memcmp(header.e_ident, elf32_magic, EI_CLASS) || header.e_ident[EI_CLASS] != EI_CLASS_32BIT ||
+        header.e_ident[EI_DATA] != EI_DATA_LITTLE || header.e_type != ET_DYN || header.e_machine != EM_ARM ||
+        header.e_phentsize != sizeof(elf32_phdr) || !header.e_phnum)
+        return -1;
+
+    int count = header.e_phnum;
+    elf32_phdr* phdrs = kmalloc(count * sizeof(elf32_phdr));
+    if (!phdrs)
+        return -1;
+
+    if (read_at(src, header.e_phoff, phdrs, count * sizeof(elf32_phdr)) < 0)
+    {
+        kfree(phdrs);
+        return -1;
+    }
+
+    // A read-only segment, an eventual writable one, that's all
+    const elf32_phdr* text = 0;
+    const elf32_phdr* data = 0;
+    const elf32_phdr* dyn = 0;
+    int err = 0;
+
+    for (int i = 0; i < count && !err; ++i)
+    {
+        const elf32_phdr* ph = &phdrs[i];
+
+        if (ph->p_type == PT_DYNAMIC)
+        {
+            dyn = ph;
+            continue;
+        }
+
+        if (ph->p_type != PT_LOAD)
+            continue;
+
+        if (ph->p_vaddr % 4 || ph->p_filesz > ph->p_memsz)
+            err = 1;
+        else if (ph->p_flags & PF_W)
+        {
+            err = data != 0;
+            data = ph;
+        }
+        else
+        {
+            // The read-only segment is shared as is, it can't have .bss
+            err = text || ph->p_filesz != ph->p_memsz || !ph->p_filesz;
+            text = ph;
+        }
+    }
+
+    if (err || !text)
+    {
+        kfree(phdrs);
+        return -1;
+    }
+
+    img->text_vaddr = text->p_vaddr;
+    img->text_size = text->p_filesz;
+    img->text = map(src, text->p_offset, text->p_filesz);
+
+    if (data)
+    {
+        img->data_vaddr = data->p_vaddr;
+        img->data_filesz = data->p_filesz;
+        img->data_memsz = data->p_memsz;
+        if (data->p_filesz)
+            img->data = map(src, data->p_offset, data->p_filesz);
+    }
+
+    // Without a global offset table, r9 is left pointing
+    //   to the data segment
+    img->got = img->data_vaddr;
+    img->entry = header.e_entry;
+
+    err = !img->text || (img->data_filesz && !img->data);
+    if (!err && dyn)
+        err = read_dynamic(img, src, dyn, phdrs, count) < 0;
+
+    kfree(phdrs);
+
+    if (err)
+        return -1;
+
+    // The entry point must be code, and r9 must point to the data
+    elf32_addr entry = img->entry & ~1;
+    if (entry < img->text_vaddr || entry - img->text_vaddr >= img->text_size)
+        return -1;
+
+    if (img->got < img->data_vaddr || img->got - img->data_vaddr > img->data_memsz)
+        return -1;
+
+    return check_rels(img);
+}
+
+//! Load a program's image in its own arena
+//! \param path Path of the executable file
+//! \return The image, 0 if error(s) occured
+static struct image* load_image(const char* path)
+{
+    struct inode* in = vfs_find(path);
+    if (!in)
+    {
+        kprint(KPRINT_ERR "failed to load program '%s': file does not exists\n", path);
+        return 0;
+    }
+
+    struct source src = { in, 0, 0, 0 };
+    char* raw;
+    int raw_size;
+
+    // Blobs living in RAM are executed in place, other
+    //   files are read in a copy
+    if (vfs_rawptr(in, (void**)&raw, &raw_size) == 0 && raw)
+    {
+        src.raw = raw;
+        src.raw_size = raw_size;
+        src.xip = (in->superblock->flags & FSF_RAM) != 0;
+    }
+    else if (!in->superblock->read)
+    {
+        kprint(KPRINT_ERR "failed to load program '%s': file can't be read\n", path);
+        return 0;
+    }
+
+    int arena = kmalloc_arena_create();
+    if (arena < 0)
+    {
+        kprint(KPRINT_ERR "failed to load program '%s': too many arenas\n", path);
+        return 0;
+    }
+
+    int previous = kmalloc_arena_use(arena);
+
+    struct image* img = kmalloc(sizeof(struct image));
+    char* copy = kmalloc(strlen(path) + 1);
+    if (img)
+    {
+        memset(img, 0, sizeof(struct image));
+        img->arena = arena;
+        img->path = copy;
+    }
+
+    int err = !img || !copy || parse(img, &src) < 0;
+
+    kmalloc_arena_use(previous);
+
+    if (err)
+    {
+        kprint(KPRINT_ERR "failed to load program '%s': ELF error\n", path);
+        kmalloc_arena_release(arena);
+        return 0;
+    }
+
+    strcpy(copy, path);
+
+    return img;
+}
+
+//! Get a program's image, loading it if needed, and hold it
+//! \param path Path of the executable file
+//! \return The image, 0 if error(s) occured
+static struct image* hold_image(const char* path)
+{
+    uint32_t crit = kcrit_enter();
+    for (struct image* img = images; img; img = img->next)
+    {
+        if (!strcmp(img->path, path))
+        {
+            ++img->refs;
+            kcrit_exit(crit);
+            return img;
+        }
+    }
+    kcrit_exit(crit);
+
+    struct image* loaded = load_image(path);
+    if (!loaded)
+        return 0;
+
+    // Someone else may have loaded it meanwhile
+    crit = kcrit_enter();
+    for (struct image* img = images; img; img = img->next)
+    {
+        if (!strcmp(img->path, path))
+        {
+            ++img->refs;
+            kcrit_exit(crit);
+            kmalloc_arena_release(loaded->arena);
+            return img;
+        }
+    }
+
+    loaded->refs = 1;
+    loaded->next = images;
+    images = loaded;
+    kcrit_exit(crit);
+
+    return loaded;
+}
+
+//! Release a held image, unloading it if it
+//!   has no instances anymore
+//! \param img The image
+static void release_image(struct image* img)
+{
+    uint32_t crit = kcrit_enter();
+    if (--img->refs)
+    {
+        kcrit_exit(crit);
+        return;
+    }
+
+    for (struct image** it = &images; *it; it = &(*it)->next)
+    {
+        if (*it == img)
+        {
+            *it = img->next;
+            break;
+        }
+    }
+    kcrit_exit(crit);
+
+    kmalloc_arena_release(img->arena);
+}
+
+//! Create an instance of a program in its own arena : copy
+//!   its data segment and relocate it
+//! \param img The program's image
+//! \param arg Argument to pass to the program
+//! \return The instance, 0 if error(s) occured
+static struct instance* instantiate(struct image* img, void* arg)
+{
+    int arena = kmalloc_arena_create();
+    if (arena < 0)
+        return 0;
+
+    int previous = kmalloc_arena_use(arena);
+    struct instance* inst = kmalloc(sizeof(struct instance));
+    char* data = img->data_memsz ? kmalloc(img->data_memsz) : 0;
+    kmalloc_arena_use(previous);
+
+    if (!inst || (img->data_memsz && !data))
+    {
+        kmalloc_arena_release(arena);
+        return 0;
+    }
+
+    // Initialized data, then .bss
+    if (img->data_filesz)
+        memcpy(data, img->data, img->data_filesz);
+    memset(data + img->data_filesz, 0, img->data_memsz - img->data_filesz);
+
+    // Those were checked when loading the image
+    for (int i = 0; i < img->rels_count; ++i)
+    {
+        const elf32_rel* rel = &img->rels[i];
+        if (ELF32_R_TYPE(rel->r_info) != R_ARM_RELATIVE)
+            continue;
+
+        elf32_addr* at = (elf32_addr*)(data + (rel->r_offset - img->data_vaddr));
+        relocate(img, data, *at, at);
+    }
+
+    inst->img = img;
+    inst->arena = arena;
+    inst->entry = (void*)(img->text + (img->entry - img->text_vaddr));
+    inst->pic_base = data + (img->got - img->data_vaddr);
+    inst->arg = arg;
+
+    return inst;
+}
+
+//! Timer callback waking up a task
+//! \param arg The task
+static void wake(void* arg)
+{
+    ksched_wakeup((struct ktask*)arg);
+}
+
+//! Wait until no task allocates from an arena anymore
+//! \param arena The arena
+static void wait_children(int arena)
+{
+    if (ksched_arena_tasks(arena) == 0)
+        return;
+
+    ktimer* timer = ktimer_create(&wake, ksched_current(), 0);
+    if (!timer)
+        return;
+
+    while (ksched_arena_tasks(arena) > 0)
+    {
+        // Sleeping in the critical section, the wakeup can't be missed
+        uint32_t crit = kcrit_enter();
+        ktimer_start(timer, CHILDREN_POLL_PERIOD);
+        ksched_sleep();
+        kcrit_exit(crit);
+    }
+
+    ktimer_destroy(timer);
+}
+
+//! Entry point of a program's task, run the instance and
+//!   release it when it returns
+//! \param arg The instance
+static void run(void* arg)
+{
+    struct instance* inst = (struct instance*)arg;
+    struct image* img = inst->img;
+    int arena = inst->arena;
+
+    kmalloc_arena_use(arena);
+    kprog_call(inst->arg, inst->entry, inst->pic_base);
+
+    // The instance itself is in its arena, that the tasks
+    //   the program spawned inherited : they may still
+    //   run its code and use its data
+    kmalloc_arena_use(KMALLOC_ARENA_KERNEL);
+    wait_children(arena);
+
+    // Keep the image if they are still there
+    if (kmalloc_arena_release(arena) < 0)
+    {
+        kprint(KPRINT_ERR "program '%s' not released: its tasks are still running\n", img->path);
+        return;
+    }
+
+    release_image(img);
+}
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+int kprog_spawn(const char* path, void* arg)
+{
+    if (!path)
+        return -1;
+
+    struct image* img = hold_image(path);
+    if (!img)
+        return -1;
+
+    struct instance* inst = instantiate(img, arg);
+    if (!inst)
+    {
+        kprint(KPRINT_ERR "failed to start program '%s': kmalloc error\n", path);
+        release_image(img);
+        return -1;
+    }
+
+    // The task starts in the kernel's arena, and switches
+    //   to the instance's one by itself (see run())
+    int previous = kmalloc_arena_use(KMALLOC_ARENA_KERNEL);
+    int pid = ksched_spawn(vfs_filename(img->path), (void*)&run, inst);
+    kmalloc_arena_use(previous);
+
+    if (pid < 0)
+    {
+        kmalloc_arena_release(inst->arena);
+        release_image(img);
+    }
+
+    return pid;
+}
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(kprog_spawn);
@@ -0,0 +1,72 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+.syntax unified
+.cpu cortex-m4
+.thumb
+.text
+
+///////////////////////////
+//// Module parameters ////
+///////////////////////////
+
+// N/A
+
+////////////////////////////////
+//// Module's sanity checks ////
+////////////////////////////////
+
+// N/A
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+// N/A
+
+///////////////////////////////////////
+//// Module's forward declarations ////
+///////////////////////////////////////
+
+.global kprog_call
+
+/////////////////////////////////////
+//// Module's internal variables ////
+/////////////////////////////////////
+
+// N/A
+
+/////////////////////////////////////
+//// Module's internal functions ////
+/////////////////////////////////////
+
+// N/A
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+//! Call a program's entry point (r1) with its argument (r0) and
+//!   its PIC base (r2) in r9. The program never changes r9, but
+//!   the kernel's r9 is restored anyway before returning.
+.type  kprog_call, %function
+kprog_call:
+    push {r9, lr}
+    mov r9, r2
+    blx r1
+    pop {r9, pc}
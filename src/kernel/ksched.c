@@ -17,8 +17,14 @@
  */
 
 #include "kernel/ksched.h"
+#include "kernel/ksymbols.h"
 #include "kernel/ksched_primitives.h"
 #include "kernel/kmalloc.h"
+#include "kernel/kcrit.h"
+#include "kernel/ktimer.h"
+#include "kernel/ktime.h"
+#include "kernel/kvsys.h"
+#include "kernel/ksysring.h"
 #include "drivers/systick.h"
 #include "drivers/pendsv.h"
 
@@ -31,8 +37,8 @@
 #define KERNEL_STACK_SIZE 256
 
 //! Size (in words) of each task's stack
-//!   size
-#define TASK_STACK_SIZE 128
+//!   size (system calls run on it too)
+#define TASK_STACK_SIZE 256
 
 //! Base address of the stack
 #define STACK_BASE ((void*)0x20000000)
@@ -76,17 +82,23 @@ enum
 
 static int tasks_add(struct ktask* task);
 static int tasks_remove(struct ktask* task);
+static int reap(struct ktask* task);
+static void reap_dead();
 static struct ktask* new_task(int pid, const char* name, void* start, void* exit, void* arg);
 static int init_stack();
 static void* alloc_stack_page();
 static int free_stack_page(void*);
 static int next_pid();
 static int spawn(const char* name, void* start, void* exit, void* arg);
+static int change_policy(struct ksched_policy* policy);
 static int schedule();
 static void context_switch();
+static void tick();
+static void tick_switch();
 static int rr_init_sched_data(struct ktask* task);
 static int rr_schedule(struct ktask* tasks_list, struct ktask** current);
 static int h_exit();
+static void idle(void* arg);
 
 /////////////////////////////////////
 //// Module's internal variables ////
@@ -148,7 +160,7 @@ static int tasks_add(struct ktask* task)
 }
 
 //! Remove a task from the linked list. This
-//!   *does* free the task
+//!   does *not* free the task
 //! \param task The task to remove
 //! \return 0 if OK, -1 otherwise
 static int tasks_remove(struct ktask* task)
@@ -162,6 +174,29 @@ static int tasks_remove(struct ktask* task)
     task->next = 0;
     task->prev = 0;
 
+    return 0;
+}
+
+//! Remove a dead task from the list, release its
+//!   stack page and free it. This calls kfree(), so it
+//!   must be called from task context, never from the scheduler
+//! \param task The task to reap (must not be running anymore)
+//! \return 0 if OK, -1 otherwise
+static int reap(struct ktask* task)
+{
+    if (!task || task->state != KTASK_DEAD || task == current_task)
+        return -1;
+
+    // Unlink it first, so that nobody can find it anymore
+    uint32_t crit = kcrit_enter();
+    int err = tasks_remove(task);
+    if (err == 0)
+        err = free_stack_page(task->page);
+    kcrit_exit(crit);
+
+    if (err < 0)
+        return -1;
+
     if (task->sched_data)
         kfree(task->sched_data);
     kfree(task);
@@ -169,6 +204,34 @@ static int tasks_remove(struct ktask* task)
     return 0;
 }
 
+//! Reap all the tasks that exited since the last call
+//! Exited tasks are left in the list by the scheduler, they
+//!   are collected here from task context (see reap())
+static void reap_dead()
+{
+    if (!tasks_list)
+        return;
+
+    for (;;)
+    {
+        struct ktask* dead = 0;
+
+        uint32_t crit = kcrit_enter();
+        for (struct ktask* task = tasks_list->next; task != tasks_list; task = task->next)
+        {
+            if (task->state == KTASK_DEAD && task != current_task)
+            {
+                dead = task;
+                break;
+            }
+        }
+        kcrit_exit(crit);
+
+        if (!dead || reap(dead) < 0)
+            return;
+    }
+}
+
 //! Create a new valid task structure, but do
 //!   *not* insert it into the list, neither initialize
 //!   its scheduler-specific data
@@ -189,6 +252,9 @@ static struct ktask* new_task(int pid, const char* name, void* start, void* exit
     task->pid = pid;
     task->name = name;
     task->sched_data = 0;
+    task->prio = KSCHED_PRIO_DEFAULT;
+    task->state = KTASK_READY;
+    task->arena = KMALLOC_ARENA_KERNEL;
     task->next = task->prev = 0;
 
     // Get some stack space
@@ -316,19 +382,61 @@ static int spawn(const char* name, void* start, void* exit, void* arg)
     if (pid < 0)
         return -1;
 
+    // The task's structures belong to the kernel, they must
+    //   outlive the arena of whoever spawned it
+    int arena = kmalloc_arena_use(KMALLOC_ARENA_KERNEL);
+
     struct ktask* task = new_task(pid, name, start, exit, arg);
-    if (!task)
-        return -1;
+    int err = !task || tasks_add(task) < 0 || current_policy->init_sched_data(task) < 0;
 
-    if (tasks_add(task) < 0)
-        return -1;
+    kmalloc_arena_use(arena);
 
-    if (current_policy->init_sched_data(task) < 0)
+    if (err)
         return -1;
 
+    // It allocates from its parent's arena
+    task->arena = arena;
+
     return pid;
 }
 
+//! Switch scheduling policies, must be called
+//!   from within a critical section.
+//! \param policy The new scheduling policy
+//! \return -1 if error(s) occured, 0 otherwise
+static int change_policy(struct ksched_policy* policy)
+{
+    // Notify old policy about its removal
+    if (current_policy->remove)
+    {
+        if (current_policy->remove() < 0)
+            return -1;
+    }
+
+    // Switch policies
+    current_policy = policy;
+
+    // Notify new policy about its insertion
+    if (current_policy->insert)
+    {
+        if (current_policy->insert() < 0)
+            return -1;
+    }
+
+    // Reset all tasks' policy-specific data
+    for (struct ktask* task = tasks_list->next; task != tasks_list; task = task->next)
+    {
+        if (task->sched_data)
+        {
+            kfree(task->sched_data);
+            if (current_policy->init_sched_data(task) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
 //! Schedule the next task to run and switch to it
 //! This uses the scheduling service provided by the current
 //!   policy to determine the next task to run
@@ -344,13 +452,20 @@ static int schedule()
     //   we just setup our stack pointer
     if (!current_task)
     {
+        // Elect the first task, starting the
+        //   search from the dummy root task
+        struct ktask* next = tasks_list;
+        if (current_policy->schedule(tasks_list, &next) < 0)
+            return -1;
+
         // If we don't have any task to run,
         //   don't do bad stuff
-        if (tasks_list->next == tasks_list)
+        if (next == tasks_list)
             return -1;
 
         // Setup the current task
-        current_task = tasks_list->next;
+        current_task = next;
+        kvsys_update_task(current_task->pid);
 
         // Write the stack pointer, the initial
         //   stack frame was crafted in spawn(),
@@ -376,6 +491,7 @@ static int schedule()
             write_psp(next->sp);
 
             current_task = next;
+            kvsys_update_task(current_task->pid);
         }
     }
 
@@ -395,6 +511,24 @@ static void __attribute__((naked)) context_switch()
     thread_mode();
 }
 
+//! Account for an elapsed SysTick period, this
+//!   advances all tick-driven kernel services
+static void tick()
+{
+    ktime_tick();
+    ktimer_tick();
+}
+
+//! Account for an elapsed tick, then request a context switch
+//!   to let the scheduler run. The switch itself is left to
+//!   PendSV, so that contexts are only ever saved and loaded by
+//!   a single exception that can't be nested (see irqprio.h)
+static void tick_switch()
+{
+    tick();
+    pendsv_trigger();
+}
+
 //! This is the policy-specific task data initializer
 //!   for the default shipped round-robin scheduling policy
 //! \param task The task to setup
@@ -410,6 +544,8 @@ static int rr_init_sched_data(struct ktask* task)
 
 //! This is the actual scheduling function for the
 //!   default shipped round-robin scheduling policy
+//! The highest priority ready task is elected, tasks sharing
+//!   the same priority are served in a round-robin fashion
 //! \param tasks_list A pointer to the tasks list
 //! \param current Output pointer to the current task,
 //!                this function will eventually change
@@ -423,13 +559,29 @@ static int rr_schedule(struct ktask* tasks_list, struct ktask** current)
     if (!*current)
         return -1;
 
-    // Just loop in the tasks list
-    *current = (*current)->next;
+    // Loop once in the tasks list, starting just after the
+    //   current task (that is examined last), so that the first
+    //   best candidate found is the next one in round-robin order
+    struct ktask* best = 0;
+    struct ktask* task = *current;
+    do
+    {
+        task = task->next;
+
+        // Remember that the very first task is a dummy one,
+        //   so be careful not to set it current
+        if (task == tasks_list || task->state != KTASK_READY)
+            continue;
 
-    // Remember that the very first task is a dummy one,
-    //   so be careful not to set it current
-    if (*current == tasks_list)
-        *current = (*current)->next;
+        if (!best || task->prio > best->prio)
+            best = task;
+    } while (task != *current);
+
+    // The idle task is always ready, so this should not happen
+    if (!best)
+        return -1;
+
+    *current = best;
 
     return 0;
 }
@@ -442,8 +594,13 @@ static int h_exit()
     if (!current_task)
         return -1;
 
-    if (tasks_remove(current_task) < 0)
-        return -1;
+    // Release what the task registered while it still exists
+    ksysring_exit();
+
+    // The task is still running on its own stack, so it
+    //   is left in the list and reaped later from task
+    //   context, by the idle task or the next spawn
+    current_task->state = KTASK_DEAD;
 
     // Trigger a PendSV interruption, that will
     //   call context_switch() artificially
@@ -452,14 +609,28 @@ static int h_exit()
     return 0;
 }
 
+//! This is the idle task, elected when no other
+//!   task is ready to run
+//! \param arg Unused
+static void idle(void* arg)
+{
+    (void)arg;
+
+    for (;;)
+    {
+        reap_dead();
+        __WFI();
+    }
+}
+
 ////////////////////////////
 //// Interrupt handlers ////
 ////////////////////////////
 
-//! Systick IRQ handler, alias of our context switch routine
-//! This one is used to periodically call the scheduler and
+//! Systick IRQ handler, alias of our ticking routine
+//! This one is used to periodically request a schedule, to
 //!   switch between tasks
-void __attribute__((alias("context_switch"))) irq_systick_handler();
+void __attribute__((alias("tick_switch"))) irq_systick_handler();
 
 //! PendSV IRQ handler, alias of our context switch routine
 //! This one is used to trigger a schedule immediately (for example
@@ -487,18 +658,28 @@ int ksched_init()
     root->pid = 0;
     root->name = "[root]";
     root->sched_data = 0;
+    root->prio = KSCHED_PRIO_IDLE;
+    root->state = KTASK_SLEEPING;
     root->page = 0;
     root->sp = 0;
+    root->arena = KMALLOC_ARENA_KERNEL;
     root->prev = root->next = root;
 
     tasks_list = root;
 
-    // Init Systick and PendSV stuff
-    systick_init();
+    // Init PendSV stuff, the Systick is
+    //   configured by ktime_init()
     pendsv_init();
 
     current_task = 0;
 
+    // Create the idle task, that runs when
+    //   no other task is ready
+    int pid = spawn("[idle]", (void*)&idle, (void*)&h_exit, 0);
+    if (pid < 0)
+        return -1;
+    ksched_task_by_pid(pid)->prio = KSCHED_PRIO_IDLE;
+
     // fork() :
     //  create using new_task(), copying all stuff
     //  register with tasks_add()
@@ -506,57 +687,75 @@ int ksched_init()
     return 0;
 }
 
+int ksched_start()
+{
+    if (!tasks_list || current_task)
+        return -1;
+
+    // Start the Systick and trigger a context switch
+    systick_start();
+    pendsv_trigger();
+
+    return -1;
+}
+
 struct ktask* ksched_task_by_pid(int pid)
 {
     if (!tasks_list)
         return 0;
 
+    struct ktask* found = 0;
+    uint32_t crit = kcrit_enter();
+
     for (struct ktask* task = tasks_list->next; task != tasks_list; task = task->next)
     {
         if (!task)
-            return 0;
+            break;
 
         if (task->pid == pid)
-            return task;
+        {
+            found = task;
+            break;
+        }
     }
 
-    return 0;
+    kcrit_exit(crit);
+
+    return found;
 }
 
-int ksched_change_policy(struct ksched_policy* policy)
+int ksched_arena_tasks(int arena)
 {
-    if (!policy)
-        return -1;
+    if (!tasks_list)
+        return 0;
 
-    // Notify old policy about its removal
-    if (current_policy->remove)
+    int count = 0;
+    uint32_t crit = kcrit_enter();
+
+    for (struct ktask* task = tasks_list->next; task != tasks_list; task = task->next)
     {
-        if (current_policy->remove() < 0)
-            return -1;
+        if (task->state != KTASK_DEAD && task->arena == arena)
+            ++count;
     }
 
-    // Switch policies
-    current_policy = policy;
+    kcrit_exit(crit);
 
-    // Notify new policy about its insertion
-    if (current_policy->insert)
-    {
-        if (current_policy->insert() < 0)
-            return -1;
-    }
+    return count;
+}
 
-    // Reset all tasks' policy-specific data
-    for (struct ktask* task = tasks_list->next; task != tasks_list; task = task->next)
-    {
-        if (task->sched_data)
-        {
-            kfree(task->sched_data);
-            if (current_policy->init_sched_data(task) < 0)
-                return -1;
-        }
-    }
+int ksched_change_policy(struct ksched_policy* policy)
+{
+    if (!policy)
+        return -1;
 
-    return 0;
+    // The scheduler must not run with a half-switched policy
+    uint32_t crit = kcrit_enter();
+    int arena = kmalloc_arena_use(KMALLOC_ARENA_KERNEL);
+    int err = change_policy(policy);
+    kmalloc_arena_use(arena);
+    kcrit_exit(crit);
+
+    return err;
 }
 
 int ksched_spawn(const char* name, void* start, void* arg)
@@ -564,17 +763,100 @@ int ksched_spawn(const char* name, void* start, void* arg)
     if (!tasks_list || !current_policy || !name || !start)
         return -1;
 
-    int pid;
-    if ((pid = spawn(name, start, (void*)&h_exit, arg)) < 0)
+    // Exited tasks still hold their pid and stack page
+    reap_dead();
+
+    uint32_t crit = kcrit_enter();
+    int pid = spawn(name, start, (void*)&h_exit, arg);
+    kcrit_exit(crit);
+
+    return pid;
+}
+
+int ksched_set_priority(int pid, int prio)
+{
+    if (prio < KSCHED_PRIO_MIN || prio > KSCHED_PRIO_MAX)
         return -1;
 
-    // The very first time, start the Systick and
-    //   trigger a context switch
+    // The idle task priority is fixed
+    struct ktask* task = ksched_task_by_pid(pid);
+    if (!task || task->prio == KSCHED_PRIO_IDLE)
+        return -1;
+
+    task->prio = prio;
+
+    // Let the scheduler re-evaluate its choice
+    if (current_task)
+        pendsv_trigger();
+
+    return 0;
+}
+
+struct ktask* ksched_current()
+{
+    return current_task;
+}
+
+int ksched_getpid()
+{
     if (!current_task)
-    {
-        systick_start();
+        return -1;
+
+    return current_task->pid;
+}
+
+void ksched_yield()
+{
+    pendsv_trigger();
+}
+
+void ksched_sleep()
+{
+    if (!current_task)
+        return;
+
+    current_task->state = KTASK_SLEEPING;
+    pendsv_trigger();
+}
+
+int ksched_exit()
+{
+    // An interrupt handler has no task of its own to kill
+    if (__get_IPSR() || h_exit() < 0)
+        return -1;
+
+    // The switch happens as soon as PendSV is taken,
+    //   and a dead task is never elected again
+    for (;;)
+        ;
+}
+
+int ksched_wakeup(struct ktask* task)
+{
+    if (!task || task->state == KTASK_DEAD)
+        return -1;
+
+    task->state = KTASK_READY;
+
+    // Preempt the current task if the awoken one is more urgent
+    if (current_task && task->prio > current_task->prio)
         pendsv_trigger();
-    }
 
-    return pid;
+    return 0;
 }
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(ksched_task_by_pid);
+EXPORT_KSYMBOL(ksched_arena_tasks);
+EXPORT_KSYMBOL(ksched_change_policy);
+EXPORT_KSYMBOL(ksched_spawn);
+EXPORT_KSYMBOL(ksched_set_priority);
+EXPORT_KSYMBOL(ksched_current);
+EXPORT_KSYMBOL(ksched_getpid);
+EXPORT_KSYMBOL(ksched_yield);
+EXPORT_KSYMBOL(ksched_sleep);
+EXPORT_KSYMBOL(ksched_exit);
+EXPORT_KSYMBOL(ksched_wakeup);
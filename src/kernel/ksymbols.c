@@ -18,6 +18,7 @@
 
 #include "kernel/ksymbols.h"
 #include "kernel/kmalloc.h"
+#include "kernel/kcrit.h"
 
 #include "kernel/kprint.h"
 
@@ -27,97 +28,221 @@
 //// Module parameters ////
 ///////////////////////////
 
-//! The kernel symbol table is always a multiple
-//!   of the bulk size (in bytes) to avoid too much reallocations.
-#define BULK_SIZE 32
+//! Initial size of the run time symbols hash table,
+//!   it doubles each time it gets half full
+#define OVERLAY_INITIAL_SIZE 32
 
 ////////////////////////////////
 //// Module's sanity checks ////
 ////////////////////////////////
 
+#if OVERLAY_INITIAL_SIZE & (OVERLAY_INITIAL_SIZE - 1)
+#error "OVERLAY_INITIAL_SIZE must be a power of 2"
+#endif
+
 //////////////////////////////
 //// Module's definitions ////
 //////////////////////////////
 
-//! The internal kernel symbol structure.
-typedef struct
+//! Just for readability
+typedef struct ksymbol_entry symbol;
+
+//! A run time symbol
+struct overlay_entry
 {
-    //! Name of the kernel symbol (must be unique)
+    //! Name and location of the symbol
     const char* name;
-    //! Location of the kernel symbol
     void* location;
-} symbol;
+    //! The kmalloc arena in use when it was added (see
+    //!   ksymbol_remove_arena())
+    int arena;
+};
+
+///////////////////////////////////////
+//// Module's forward declarations ////
+///////////////////////////////////////
+
+static uint32_t hash(const char* name);
+static const symbol* flash_find(const char* name);
+static int overlay_find(const char* name);
+static void overlay_put(struct overlay_entry* table, int size, const char* name, void* location, int arena);
+static int overlay_grow();
+static void overlay_delete(int slot);
 
 /////////////////////////////////////
 //// Module's internal variables ////
 /////////////////////////////////////
 
-//! Number of available entries in the kernel's symbol
-//!   table. This does NOT represent the number of valid
-//!   symbols.
-static int symbols_table_size = 0;
+//! Bounds of the link-time symbol table (in flash)
+extern const symbol _ld_ksymtab_start[];
+extern const symbol _ld_ksymtab_end[];
+
+//! Run time symbols (open addressing, linear probing),
+//!   free slots have a null name
+static struct overlay_entry* overlay = 0;
 
-//! Start address of the kernel's smbol table.
-static symbol* symbols_table = 0;
+//! Number of slots in the above table (a power of 2)
+static int overlay_size = 0;
+
+//! Number of used slots in the above table
+static int overlay_count = 0;
 
 /////////////////////////////////////
 //// Module's internal functions ////
 /////////////////////////////////////
 
-//! Get the next free symbol slot in the table,
-//!   eventually growing it
-//! \return A pointer to the free symbol slot,
-//!         0 if error(s) occured
-static symbol* add_symbol()
+//! Hash a symbol name (FNV-1a)
+//! \param name The name to hash
+//! \return The hash value
+static uint32_t hash(const char* name)
 {
-    // Attempt to find an unused slot
-    for (int i = 0; i < symbols_table_size; ++i)
+    uint32_t h = 2166136261u;
+
+    for (const unsigned char* c = (const unsigned char*)name; *c; ++c)
+        h = (h ^ *c) * 16777619u;
+
+    return h;
+}
+
+//! Binary search the link-time symbol table
+//! \param name The symbol's name
+//! \return The symbol's entry, 0 if not found
+static const symbol* flash_find(const char* name)
+{
+    int lo = 0;
+    int hi = _ld_ksymtab_end - _ld_ksymtab_start;
+
+    while (lo < hi)
     {
-        if (!symbols_table[i].name || !symbols_table[i].location)
-        {
-            return symbols_table + i;
-        }
+        int mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(name, _ld_ksymtab_start[mid].name);
+
+        if (cmp == 0)
+            return _ld_ksymtab_start + mid;
+        else if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
     }
 
-    // If we got here, we didn't found any free symbol, and so
-    //   we must resize the table
-    int next_id = symbols_table_size;
+    return 0;
+}
 
-    // Realloc
-    int new_size = symbols_table_size + BULK_SIZE;
-    symbols_table = krealloc(symbols_table, new_size * sizeof(symbol));
-    if (!symbols_table)
-        return 0;
+//! Find a run time symbol, must be called from
+//!   within a critical section.
+//! \param name The symbol's name
+//! \return The symbol's slot, -1 if not found
+static int overlay_find(const char* name)
+{
+    if (!overlay)
+        return -1;
+
+    int mask = overlay_size - 1;
+    for (int slot = hash(name) & mask; overlay[slot].name; slot = (slot + 1) & mask)
+    {
+        if (strcmp(overlay[slot].name, name) == 0)
+            return slot;
+    }
+
+    return -1;
+}
+
+//! Put a symbol in a free slot of a table
+//! \param table The table
+//! \param size Its size (a power of 2), it must not be full
+//! \param name The symbol's name
+//! \param location The symbol's location
+//! \param arena The symbol's arena
+static void overlay_put(struct overlay_entry* table, int size, const char* name, void* location, int arena)
+{
+    int mask = size - 1;
+    int slot = hash(name) & mask;
+
+    while (table[slot].name)
+        slot = (slot + 1) & mask;
+
+    table[slot].name = name;
+    table[slot].location = location;
+    table[slot].arena = arena;
+}
+
+//! Double the size of the run time symbol table,
+//!   must be called from within a critical section.
+//! \return 0 if OK, -1 otherwise
+static int overlay_grow()
+{
+    int new_size = overlay_size ? overlay_size * 2 : OVERLAY_INITIAL_SIZE;
+
+    // The table outlives whichever module is being loaded
+    int arena = kmalloc_arena_use(KMALLOC_ARENA_KERNEL);
+    struct overlay_entry* table = kmalloc(new_size * sizeof(struct overlay_entry));
+    kmalloc_arena_use(arena);
+    if (!table)
+        return -1;
+
+    for (int i = 0; i < new_size; ++i)
+    {
+        table[i].name = 0;
+        table[i].location = 0;
+    }
 
-    // Nullify unused symbols
-    for (int i = symbols_table_size; i < new_size; ++i)
+    // Rehash
+    for (int i = 0; i < overlay_size; ++i)
     {
-        symbols_table[i].name = 0;
-        symbols_table[i].location = 0;
+        if (overlay[i].name)
+            overlay_put(table, new_size, overlay[i].name, overlay[i].location, overlay[i].arena);
     }
 
-    // Update size
-    symbols_table_size = new_size;
+    kfree(overlay);
+    overlay = table;
+    overlay_size = new_size;
 
-    return symbols_table + next_id;
+    return 0;
+}
+
+//! Free a slot of the run time symbol table, shifting back
+//!   the following entries of its cluster so that no lookup
+//!   stops early, must be called from within a critical section.
+//! \param slot The slot to free
+static void overlay_delete(int slot)
+{
+    int mask = overlay_size - 1;
+    int hole = slot;
+
+    for (int i = (hole + 1) & mask; overlay[i].name; i = (i + 1) & mask)
+    {
+        // Move the entry to the hole if its home
+        //   slot is not cyclically in ]hole, i]
+        int home = hash(overlay[i].name) & mask;
+        int dist_home = (i - home) & mask;
+        int dist_hole = (i - hole) & mask;
+
+        if (dist_home >= dist_hole)
+        {
+            overlay[hole] = overlay[i];
+            hole = i;
+        }
+    }
+
+    overlay[hole].name = 0;
+    overlay[hole].location = 0;
+    --overlay_count;
 }
 
 //! Print out the kernel's symbol table.
 static void __attribute__((unused)) dump(void (*debug)(const char*, ...))
 {
-    int i;
-    for (i = 0; i < symbols_table_size; ++i)
+    for (const symbol* sym = _ld_ksymtab_start; sym < _ld_ksymtab_end; ++sym)
+        (*debug)("%25s @ %8x\n", sym->name, sym->location);
+
+    for (int i = 0; i < overlay_size; ++i)
     {
-        symbol* sym = symbols_table + i;
-        if (!sym->name || !sym->location)
+        struct overlay_entry* sym = overlay + i;
+        if (!sym->name)
             continue;
 
-        (*debug)("%25s @ %8x\n", sym->name, sym->location);
+        (*debug)("%25s @ %8x (runtime)\n", sym->name, sym->location);
     }
-
-    int more = symbols_table_size - i - 1;
-    if (more > 0)
-        (*debug)("~~~ %d more unused slots ~~~\n", more);
 }
 
 /////////////////////////////
@@ -129,15 +254,35 @@ int ksymbol_add(const char* name, void* location)
     if (!name || !location)
         return -1;
 
-    // Access the next element in the symbol table
-    symbol* sym = add_symbol(symbols_table_size);
-    if (!sym)
-        return -1;
+    int err = 0;
+    uint32_t crit = kcrit_enter();
 
-    sym->name = name;
-    sym->location = location;
+    // Symbols are withdrawn along with the arena of
+    //   whoever added them
+    int arena = kmalloc_arena_current();
 
-    return 0;
+    int slot = overlay_find(name);
+    if (slot >= 0)
+    {
+        overlay[slot].location = location;
+        overlay[slot].arena = arena;
+    }
+    else
+    {
+        // Keep the load factor below 1/2
+        if (2 * (overlay_count + 1) > overlay_size)
+            err = overlay_grow();
+
+        if (err == 0)
+        {
+            overlay_put(overlay, overlay_size, name, location, arena);
+            ++overlay_count;
+        }
+    }
+
+    kcrit_exit(crit);
+
+    return err;
 }
 
 int ksymbol_remove(const char* name)
@@ -145,20 +290,40 @@ int ksymbol_remove(const char* name)
     if (!name)
         return -1;
 
-    for (int i = 0; i < symbols_table_size; ++i)
-    {
-        symbol* sym = symbols_table + i;
-        if (!sym->name || !sym->location)
-            continue;
+    uint32_t crit = kcrit_enter();
+
+    int slot = overlay_find(name);
+    if (slot >= 0)
+        overlay_delete(slot);
 
-        if (strcmp(sym->name, name) == 0)
+    kcrit_exit(crit);
+
+    return slot >= 0 ? 0 : -1;
+}
+
+int ksymbol_remove_arena(int arena)
+{
+    int removed = 0;
+    uint32_t crit = kcrit_enter();
+
+    // Deleting a slot shifts the following ones back,
+    //   look at the same slot again
+    for (int slot = 0; slot < overlay_size;)
+    {
+        if (overlay[slot].name && overlay[slot].arena == arena)
+        {
+            overlay_delete(slot);
+            ++removed;
+        }
+        else
         {
-            sym->name = 0;
-            sym->location = 0;
+            ++slot;
         }
     }
 
-    return -1;
+    kcrit_exit(crit);
+
+    return removed;
 }
 
 void* ksymbol(const char* name)
@@ -166,15 +331,38 @@ void* ksymbol(const char* name)
     if (!name)
         return 0;
 
-    for (int i = 0; i < symbols_table_size; ++i)
-    {
-        symbol* sym = symbols_table + i;
-        if (!sym->name || !sym->location)
-            continue;
+    // The link-time table is read-only, no need to lock it
+    const symbol* sym = flash_find(name);
+    if (sym)
+        return sym->location;
 
-        if (strcmp(sym->name, name) == 0)
-            return sym->location;
-    }
+    void* location = 0;
+    uint32_t crit = kcrit_enter();
 
-    return 0;
+    int slot = overlay_find(name);
+    if (slot >= 0)
+        location = overlay[slot].location;
+
+    kcrit_exit(crit);
+
+    return location;
+}
+
+uint32_t ksymtab_checksum()
+{
+    uint32_t h = 2166136261u;
+
+    const unsigned char* start = (const unsigned char*)_ld_ksymtab_start;
+    const unsigned char* end = (const unsigned char*)_ld_ksymtab_end;
+    for (const unsigned char* c = start; c < end; ++c)
+        h = (h ^ *c) * 16777619u;
+
+    return h;
 }
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(ksymbol_add);
+EXPORT_KSYMBOL(ksymbol);
@@ -37,14 +37,40 @@
 //// Module's definitions ////
 //////////////////////////////
 
-// N/A
+//! The id of the pseudo-syscall used by ksyscall_return
+//!   to come back from a system call
+.equ SYSCALL_RETURN, 0xFF
+
+//! Size (in bytes) of the hardware-pushed exception frame
+.equ HW_FRAME_SIZE, 32
+
+//! Size (in bytes) of the stacked syscall arguments (5th and 6th)
+.equ STACKED_ARGS_SIZE, 8
+
+//! Offsets (in bytes, in the crafted frame) of the syscall id
+//!   and start cycle count, kept for ksysmap_hook
+.equ ACCT_ID, HW_FRAME_SIZE + STACKED_ARGS_SIZE
+.equ ACCT_START, ACCT_ID + 4
+
+//! Size (in bytes) of the frame crafted to run a syscall
+.equ SYSCALL_FRAME_SIZE, HW_FRAME_SIZE + STACKED_ARGS_SIZE + 8
+
+//! Address of the DWT cycle counter
+.equ DWT_CYCCNT, 0xE0001004
+
+//! Initial xPSR value for the crafted frame (Thumb state)
+.equ INITIAL_XPSR, 0x01000000
+
+//! xPSR bit set when the hardware padded the frame for alignment
+.equ XPSR_STKALIGN, 1 << 9
 
 ///////////////////////////////////////
 //// Module's forward declarations ////
 ///////////////////////////////////////
 
 .extern ksysmap
-.extern ksysmap_size
+.extern ksysmap_count
+.extern ksysmap_hook
 
 .global ksyscall_init
 .global irq_svc_handler
@@ -59,7 +85,12 @@
 //// Module's internal functions ////
 /////////////////////////////////////
 
-// N/A
+//! System calls return here (in thread mode) once done,
+//!   the syscall's return value being in r0
+.type  ksyscall_return, %function
+ksyscall_return:
+    svc #SYSCALL_RETURN
+    b . // never reached
 
 ////////////////////////////
 //// Interrupt handlers ////
@@ -67,36 +98,102 @@
 
 //! This is the IRQ handler for the service call
 //!   interrupt, that is triggered by the 'svc' instruction
+//! System calls are not run here : a new exception frame is
+//!   crafted on the task's stack (just below the one pushed by the
+//!   hardware) so that the exception return lands in the syscall
+//!   handler, in thread mode and with interrupts enabled. The system
+//!   call is thus preemptible and may block like any task code.
+//!   It then returns into ksyscall_return, whose own svc gets
+//!   us back here to write the return value in the caller's frame.
+//! The caller's r0-r3 and the two words on top of its stack
+//!   are passed to the handler as its six arguments.
 .type  irq_svc_handler, %function
 irq_svc_handler:
-	push {lr} // save the return from interrupt code
-	cpsid i // enter critical section
-
-	// Read in r0 the syscall id from the
-	//   svc instruction
+    // Read in r1 the syscall id from the
+    //   svc instruction
     mrs r0, psp
-    add r0, #24 // saved PC address in hardware context
-    ldr r0, [r0] // read saved PC value
-    sub r0, #2 // get the svc instruction address
-    ldr r0, [r0] // get instruction value
-    mov r1, #0xFF
-    and r0, r0, r1 // clear the unused bytes
-
-    // Read the syscall arguments from the saved context
-    // In r1-r3
-    mrs r4, psp
-    ldmia r4, {r1-r3}
-
-    // Branch to the appropriate syscall handler
-    // This function is defined in ksysmap.c/h
-    bl ksysmap_jump
-
-    // Write the return value in the saved context
-    // mrs r1, psp
-    // str r0, [r1]
-
-    cpsie i // exit critical section
-    pop {pc} // return from exception
+    ldr r1, [r0, #24] // read saved PC value
+    ldrh r1, [r1, #-2] // read the svc instruction
+    uxtb r1, r1 // keep the immediate
+
+    cmp r1, #SYSCALL_RETURN
+    beq 2f
+
+    // Get the syscall handler, if any
+    ldr r2, =ksysmap_count
+    ldr r2, [r2]
+    cmp r1, r2
+    bhs 1f
+    ldr r2, =ksysmap
+    ldr r12, [r2, r1, lsl #2]
+    cmp r12, #0
+    beq 1f
+
+    // Craft the syscall frame below the caller's one
+    sub r2, r0, #SYSCALL_FRAME_SIZE
+
+    // Keep the id and start time for accounting
+    str r1, [r2, #ACCT_ID]
+    ldr r1, =DWT_CYCCNT
+    ldr r1, [r1]
+    str r1, [r2, #ACCT_START]
+
+    // Copy the 5th and 6th arguments, from the caller's stack
+    //   (skipping the alignment padding if any)
+    ldr r3, [r0, #28]
+    add r1, r0, #HW_FRAME_SIZE
+    tst r3, #XPSR_STKALIGN
+    it ne
+    addne r1, #4
+    ldrd r1, r3, [r1]
+    strd r1, r3, [r2, #HW_FRAME_SIZE]
+
+    // r0-r3 = the caller's r0-r3
+    ldrd r1, r3, [r0, #0]
+    strd r1, r3, [r2, #0]
+    ldrd r1, r3, [r0, #8]
+    strd r1, r3, [r2, #8]
+
+    mov r1, #0
+    str r1, [r2, #16] // r12
+    ldr r1, =ksyscall_return
+    str r1, [r2, #20] // lr
+    bic r12, r12, #1
+    str r12, [r2, #24] // pc
+    mov r1, #INITIAL_XPSR
+    str r1, [r2, #28] // xPSR
+
+    // Return to thread mode, into the syscall
+    msr psp, r2
+    bx lr
+
+1:
+    // Invalid system call, return -1
+    mov r1, #-1
+    str r1, [r0, #0]
+    bx lr
+
+2:
+    // Coming back from ksyscall_return, its frame sits
+    //   where the syscall frame was crafted : drop it, and write
+    //   the return value in the caller's saved context
+
+    // Account for the syscall, if enabled
+    ldr r2, =ksysmap_hook
+    ldr r2, [r2]
+    cbz r2, 3f
+    push {r0, lr}
+    ldr r1, [r0, #ACCT_START]
+    ldr r0, [r0, #ACCT_ID]
+    blx r2
+    pop {r0, lr}
+
+3:
+    ldr r1, [r0, #0]
+    add r0, #SYSCALL_FRAME_SIZE
+    str r1, [r0, #0]
+    msr psp, r0
+    bx lr
 
 /////////////////////////////
 //// Public module's API ////
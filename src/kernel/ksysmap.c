@@ -17,6 +17,9 @@
  */
 
 #include "kernel/ksysmap.h"
+#include "kernel/ksymbols.h"
+#include "kernel/kcrit.h"
+#include "drivers/dwt.h"
 
 #define INCLUDES
 #include "kernel/sysmap.h"
@@ -32,7 +35,33 @@
 //// Module's sanity checks ////
 ////////////////////////////////
 
-// N/A
+//! Position of each entry in sysmap.h
+enum
+{
+#define SYSCALLS
+#define DECL_SYSCALL(id, rtp, symbol, nargs, args) SYSMAP_POS_##symbol,
+#define DECL_NOSYSCALL(id) SYSMAP_POS_##id,
+#include "kernel/sysmap.h"
+#undef DECL_NOSYSCALL
+#undef DECL_SYSCALL
+#undef SYSCALLS
+    //! Number of entries
+    SYSMAP_COUNT
+};
+
+// Check that ids follow the table order, that handlers
+//   match their declared prototype and argument count
+#define SYSCALLS
+#define DECL_SYSCALL(id, rtp, symbol, nargs, args)                                   \
+    _Static_assert((id) == SYSMAP_POS_##symbol, "sysmap.h: '" #symbol "' is out of order"); \
+    _Static_assert(_Generic(&(symbol), rtp(*) args : 1, default : 0),                \
+                   "sysmap.h: '" #symbol "' does not match its declared prototype");  \
+    _Static_assert((nargs) >= 0 && (nargs) <= 6, "sysmap.h: '" #symbol "' has too many arguments");
+#define DECL_NOSYSCALL(id) _Static_assert((id) == SYSMAP_POS_##id, "sysmap.h: removed syscall " #id " is out of order");
+#include "kernel/sysmap.h"
+#undef DECL_NOSYSCALL
+#undef DECL_SYSCALL
+#undef SYSCALLS
 
 //////////////////////////////
 //// Module's definitions ////
@@ -54,34 +83,116 @@
 //!   to registered kernel system calls.
 //! System call ids are the handler's address
 //!   in this table
-static void* ksysmap[] = {
+//! It is indexed directly by the SVC handler (see ksyscall.s)
+void* const ksysmap[] = {
 // We want the syscalls definitions
 #define SYSCALLS
 // Just take the address of the system call
-#define DECL_SYSCALL(rtp, symbol, args) (&(symbol)),
+#define DECL_SYSCALL(id, rtp, symbol, nargs, args) (&(symbol)),
+// Removed syscalls are null entries
+#define DECL_NOSYSCALL(id) 0,
 #include "kernel/sysmap.h"
 // Cleanup
+#undef DECL_NOSYSCALL
 #undef DECL_SYSCALL
 #undef SYSCALLS
 };
 
-//! Contains the size of the above array
-static int ksysmap_size = sizeof(ksysmap);
+//! Contains the number of entries of the above array
+const int ksysmap_count = sizeof(ksysmap) / sizeof(ksysmap[0]);
+
+#ifdef KSYSMAP_STATS
+//! Per-syscall statistics
+static struct ksysmap_stats stats[SYSMAP_COUNT];
+
+static void account(uint32_t id, uint32_t start);
+
+//! Called by the SVC handler when a syscall returns
+void (*const ksysmap_hook)(uint32_t, uint32_t) = &account;
+#else
+//! No accounting
+void (*const ksysmap_hook)(uint32_t, uint32_t) = 0;
+#endif
 
 /////////////////////////////////////
 //// Module's internal functions ////
 /////////////////////////////////////
 
-// N/A
+#ifdef KSYSMAP_STATS
+//! Account for a completed syscall, this runs in
+//!   the SVC handler (so it can't be preempted by another one)
+//! \param id The syscall id
+//! \param start The cycle counter value when it was issued
+static void account(uint32_t id, uint32_t start)
+{
+    if (id >= SYSMAP_COUNT)
+        return;
+
+    uint32_t cycles = DWT_CYCCNT - start;
+    struct ksysmap_stats* st = stats + id;
+
+    // Bucket i holds durations in [2^i, 2^(i+1)[,
+    //   the last one everything above
+    int bucket = cycles ? 31 - __CLZ(cycles) : 0;
+    if (bucket >= KSYSMAP_HIST_BUCKETS)
+        bucket = KSYSMAP_HIST_BUCKETS - 1;
+
+    uint32_t crit = kcrit_enter();
+
+    st->count++;
+    st->total += cycles;
+    if (cycles > st->max)
+        st->max = cycles;
+    st->hist[bucket]++;
+
+    kcrit_exit(crit);
+}
+#endif
 
 /////////////////////////////
 //// Public module's API ////
 /////////////////////////////
 
-int ksysmap_jump(int id, void* a0, void* a1, void* a2)
+int ksysmap_call(int id, const uint32_t* args)
 {
-    if (id >= ksysmap_size || !ksysmap[id])
+    if (id < 0 || id >= ksysmap_count || !ksysmap[id] || !args)
         return -1;
 
-    return ((int (*)(void*, void*, void*))ksysmap[id])(a0, a1, a2);
+    typedef int (*handler)(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+    return ((handler)ksysmap[id])(args[0], args[1], args[2], args[3], args[4], args[5]);
 }
+
+int ksysmap_stats(int id, struct ksysmap_stats* out, int reset)
+{
+#ifdef KSYSMAP_STATS
+    if (id < 0 || id >= SYSMAP_COUNT || !out)
+        return -1;
+
+    uint32_t crit = kcrit_enter();
+
+    *out = stats[id];
+    if (reset)
+    {
+        stats[id].count = 0;
+        stats[id].total = 0;
+        stats[id].max = 0;
+        for (int i = 0; i < KSYSMAP_HIST_BUCKETS; ++i)
+            stats[id].hist[i] = 0;
+    }
+
+    kcrit_exit(crit);
+
+    return 0;
+#else
+    (void)id;
+    (void)out;
+    (void)reset;
+    return -1;
+#endif
+}
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(ksysmap_stats);
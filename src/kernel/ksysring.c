@@ -0,0 +1,380 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "kernel/ksysring.h"
+#include "kernel/ksymbols.h"
+#include "kernel/ksysmap.h"
+#include "kernel/ksched.h"
+#include "kernel/ktimer.h"
+#include "kernel/kwork.h"
+#include "kernel/kcrit.h"
+#include "kernel/kmalloc.h"
+
+///////////////////////////
+//// Module parameters ////
+///////////////////////////
+
+//! Maximum number of registered rings
+#define MAX_RINGS 8
+
+//! Period (in ticks) at which polled rings are checked
+#define POLL_PERIOD 1
+
+////////////////////////////////
+//// Module's sanity checks ////
+////////////////////////////////
+
+#if POLL_PERIOD <= 0
+#error "POLL_PERIOD must be strictly positive"
+#endif
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! A ring registered by a task
+struct registration
+{
+    //! The owner's pid
+    int pid;
+    //! Setup flags
+    int flags;
+    //! Set while entries are being run
+    volatile int busy;
+    //! Set when the owner exited while its ring was
+    //!   being run, the slot is freed once it's done
+    volatile int orphan;
+    //! The ring, 0 if the slot is free
+    struct ksysring* ring;
+};
+
+///////////////////////////////////////
+//// Module's forward declarations ////
+///////////////////////////////////////
+
+static struct registration* find(int pid);
+static void drop(struct registration* reg);
+static int nested(uint32_t id);
+static int needs_caller(uint32_t id);
+static int run(struct registration* reg, int max, int polled);
+static void poll_timeout(void* arg);
+static void poll(void* arg);
+
+/////////////////////////////////////
+//// Module's internal variables ////
+/////////////////////////////////////
+
+//! Registered rings
+static struct registration regs[MAX_RINGS];
+
+//! Number of registered rings with KSYSRING_F_POLL
+static int polled_count = 0;
+
+//! Periodic timer running the poller
+static ktimer* poll_timer = 0;
+
+//! Set when the poller is queued but not run yet
+static volatile int poll_queued = 0;
+
+/////////////////////////////////////
+//// Module's internal functions ////
+/////////////////////////////////////
+
+//! Find the registration of a task, must be
+//!   called from within a critical section.
+//! \param pid The task's pid
+//! \return The registration, 0 if not found
+static struct registration* find(int pid)
+{
+    for (int i = 0; i < MAX_RINGS; ++i)
+    {
+        if (regs[i].ring && !regs[i].orphan && regs[i].pid == pid)
+            return regs + i;
+    }
+
+    return 0;
+}
+
+//! Free the slot of a registration, must be
+//!   called from within a critical section.
+//! \param reg The registration
+static void drop(struct registration* reg)
+{
+    if ((reg->flags & KSYSRING_F_POLL) && --polled_count == 0)
+        ktimer_stop(poll_timer);
+
+    reg->ring = 0;
+}
+
+//! Check if a syscall would re-enter this module
+//! \param id The syscall id
+//! \return 1 if so, 0 otherwise
+static int nested(uint32_t id)
+{
+    if (id >= (uint32_t)ksysmap_count)
+        return 0;
+
+    return ksysmap[id] == (void*)&ksysring_enter || ksysmap[id] == (void*)&ksysring_setup;
+}
+
+//! Check if a syscall depends on the identity of the calling
+//!   task, that a worker running a polled ring doesn't have
+//! \param id The syscall id
+//! \return 1 if so, 0 otherwise
+static int needs_caller(uint32_t id)
+{
+    if (id >= (uint32_t)ksysmap_count)
+        return 0;
+
+    return ksysmap[id] == (void*)&ksched_getpid;
+}
+
+//! Run the submitted entries of a ring, in order, and post
+//!   their results. A ring is only run by one task at a time.
+//! \param reg The ring's registration
+//! \param max Maximum number of entries to run
+//! \param polled Set when run by the poller, on behalf of the owner
+//! \return The number of entries run
+static int run(struct registration* reg, int max, int polled)
+{
+    uint32_t crit = kcrit_enter();
+    struct ksysring* ring = reg->busy ? 0 : reg->ring;
+    if (ring)
+        reg->busy = 1;
+    kcrit_exit(crit);
+
+    if (!ring)
+        return 0;
+
+    uint32_t mask = ring->size - 1;
+    int done = 0;
+
+    while (done < max && !reg->orphan && ring->sq_head != ring->sq_tail)
+    {
+        // Never overwrite completions the task didn't read
+        if (ring->cq_tail - ring->cq_head >= ring->size)
+            break;
+
+        // Read the entry after its publication
+        asm volatile("dmb" : : : "memory");
+
+        struct ksysring_sqe* sqe = &ring->sq[ring->sq_head & mask];
+        struct ksysring_cqe* cqe = &ring->cq[ring->cq_tail & mask];
+
+        cqe->user = sqe->user;
+        if (nested(sqe->id) || (polled && needs_caller(sqe->id)))
+            cqe->result = -1;
+        else
+            cqe->result = ksysmap_call((int)sqe->id, sqe->args);
+        ring->sq_head++;
+
+        // Publish the completion
+        asm volatile("dmb" : : : "memory");
+        ring->cq_tail++;
+
+        ++done;
+    }
+
+    crit = kcrit_enter();
+    reg->busy = 0;
+    if (reg->orphan)
+        drop(reg);
+    kcrit_exit(crit);
+
+    return done;
+}
+
+//! Poll timer callback, hands the polling to
+//!   a worker so that syscalls never run in the timer service
+//! \param arg Unused
+static void poll_timeout(void* arg)
+{
+    (void)arg;
+
+    if (poll_queued)
+        return;
+
+    poll_queued = 1;
+    if (kwork_queue(KWORK_NORMAL, &poll, 0) < 0)
+        poll_queued = 0;
+}
+
+//! Run all polled rings, dropping those whose task is gone
+//! \param arg Unused
+static void poll(void* arg)
+{
+    (void)arg;
+
+    poll_queued = 0;
+
+    for (int i = 0; i < MAX_RINGS; ++i)
+    {
+        struct registration* reg = regs + i;
+        if (!reg->ring || !(reg->flags & KSYSRING_F_POLL))
+            continue;
+
+        // The owner can't be reaped inside the critical section
+        uint32_t crit = kcrit_enter();
+        struct ktask* owner = reg->orphan ? 0 : ksched_task_by_pid(reg->pid);
+        int owner_arena = (owner && owner->state != KTASK_DEAD) ? owner->arena : -1;
+        if (owner_arena < 0 && !reg->busy && reg->ring)
+            drop(reg);
+        kcrit_exit(crit);
+
+        if (owner_arena < 0)
+            continue;
+
+        // Allocations are made on behalf of the owner, so they
+        //   are accounted to its arena and not to the worker's
+        struct ksysring* ring = reg->ring;
+        if (ring)
+        {
+            int arena = kmalloc_arena_use(owner_arena);
+            run(reg, (int)ring->size, 1);
+            kmalloc_arena_use(arena);
+        }
+    }
+}
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+int ksysring_init()
+{
+    for (int i = 0; i < MAX_RINGS; ++i)
+        regs[i].ring = 0;
+
+    poll_timer = ktimer_create(&poll_timeout, 0, KTIMER_PERIODIC);
+    if (!poll_timer)
+        return -1;
+
+    return 0;
+}
+
+int ksysring_setup(struct ksysring* ring, int flags)
+{
+    if (ring)
+    {
+        // Size must be a power of 2
+        if (!ring->size || (ring->size & (ring->size - 1)))
+            return -1;
+
+        if (!ring->sq || !ring->cq)
+            return -1;
+    }
+
+    int pid = ksched_getpid();
+    int err = 0;
+
+    uint32_t crit = kcrit_enter();
+
+    struct registration* reg = find(pid);
+
+    // The ring is being run by the poller
+    if (reg && reg->busy)
+    {
+        err = -1;
+    }
+    else
+    {
+        // Drop the previous registration
+        if (reg)
+        {
+            if (reg->flags & KSYSRING_F_POLL)
+                --polled_count;
+            reg->ring = 0;
+        }
+
+        if (ring)
+        {
+            // Find a free slot
+            reg = 0;
+            for (int i = 0; !reg && i < MAX_RINGS; ++i)
+            {
+                if (!regs[i].ring)
+                    reg = regs + i;
+            }
+
+            if (!reg)
+            {
+                err = -1;
+            }
+            else
+            {
+                reg->pid = pid;
+                reg->flags = flags;
+                reg->busy = 0;
+                reg->orphan = 0;
+                reg->ring = ring;
+
+                if (flags & KSYSRING_F_POLL)
+                    ++polled_count;
+            }
+        }
+
+        // Only keep the poller running when needed
+        if (polled_count)
+            ktimer_start(poll_timer, POLL_PERIOD);
+        else
+            ktimer_stop(poll_timer);
+    }
+
+    kcrit_exit(crit);
+
+    return err;
+}
+
+int ksysring_enter(int to_submit)
+{
+    if (to_submit <= 0)
+        return 0;
+
+    uint32_t crit = kcrit_enter();
+    struct registration* reg = find(ksched_getpid());
+    kcrit_exit(crit);
+
+    if (!reg)
+        return -1;
+
+    return run(reg, to_submit, 0);
+}
+
+void ksysring_exit()
+{
+    uint32_t crit = kcrit_enter();
+
+    struct registration* reg = find(ksched_getpid());
+    if (reg)
+    {
+        // The ring is being run, let its runner free the slot
+        if (reg->busy)
+            reg->orphan = 1;
+        else
+            drop(reg);
+    }
+
+    kcrit_exit(crit);
+}
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(ksysring_setup);
+EXPORT_KSYMBOL(ksysring_enter);
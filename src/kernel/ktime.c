@@ -0,0 +1,238 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "kernel/ktime.h"
+#include "kernel/ksymbols.h"
+#include "kernel/kvsys.h"
+#include "drivers/systick.h"
+#include "drivers/dwt.h"
+
+///////////////////////////
+//// Module parameters ////
+///////////////////////////
+
+// KTIME_HZ is defined at compile time
+#define HZ KTIME_HZ
+
+//! Fixed-point shift used to convert
+//!   cycles to nanoseconds
+#define NS_SHIFT 24
+
+////////////////////////////////
+//// Module's sanity checks ////
+////////////////////////////////
+
+#if HZ <= 0
+#error "Tick rate must be positive"
+#endif
+
+#if NS_SHIFT != KVSYS_NS_SHIFT
+#error "The vsys block must use the same fixed-point format"
+#endif
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! Nanoseconds in a second
+#define NS_PER_SEC 1000000000ULL
+
+//! SysTick reload value register is 24-bit wide
+#define MAX_PERIOD (1 << 24)
+
+///////////////////////////////////////
+//// Module's forward declarations ////
+///////////////////////////////////////
+
+static uint64_t read_ticks();
+static uint32_t elapsed_in_tick(uint64_t* ticks);
+static uint64_t scale(uint64_t cycles);
+
+/////////////////////////////////////
+//// Module's internal variables ////
+/////////////////////////////////////
+
+//! Number of SysTick periods elapsed since boot
+static volatile uint64_t ticks = 0;
+
+//! Length of a tick, in processor cycles
+static uint32_t tick_cycles = 0;
+
+//! Length of a tick, in nanoseconds
+static uint64_t tick_ns = 0;
+
+//! Cycles to nanoseconds multiplier, in
+//!   NS_SHIFT fixed-point format
+static uint32_t ns_mult = 0;
+
+/////////////////////////////////////
+//// Module's internal functions ////
+/////////////////////////////////////
+
+//! Read the tick counter without tearing
+//!   (it is 64-bit wide, and updated by an interrupt)
+//! \return The tick count
+static uint64_t read_ticks()
+{
+    uint64_t a, b;
+
+    do
+    {
+        a = ticks;
+        b = ticks;
+    } while (a != b);
+
+    return a;
+}
+
+//! Get a consistent pair of tick count and cycles
+//!   elapsed in the current tick
+//! \param now_ticks Output parameter for the tick count
+//! \return The cycles elapsed since the beginning of the tick
+static uint32_t elapsed_in_tick(uint64_t* now_ticks)
+{
+    uint64_t before, after;
+    uint32_t val;
+    int pending;
+
+    do
+    {
+        before = read_ticks();
+
+        // If the counter wrapped while the SysTick interrupt could not
+        //   be taken (for example inside a critical section), the tick
+        //   is pending and has not been accounted for yet
+        pending = SCB->ICSR & SCB_ICSR_PENDSTSET_Msk;
+        val = SysTick->VAL;
+        if (!pending && (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk))
+        {
+            // It wrapped between the two reads, so re-read the
+            //   value to be sure it belongs to the new period
+            pending = 1;
+            val = SysTick->VAL;
+        }
+
+        after = read_ticks();
+    } while (before != after);
+
+    // SysTick counts down
+    uint32_t elapsed = (tick_cycles - 1) - val;
+
+    *now_ticks = before + (pending ? 1 : 0);
+    return elapsed;
+}
+
+//! Convert a cycle count to nanoseconds with the fixed-point
+//!   multiplier. The count is split in two 32-bit halves so that
+//!   each partial product fits in 64 bits, whatever the count
+//! \param cycles The cycle count to convert
+//! \return The corresponding duration in ns
+static uint64_t scale(uint64_t cycles)
+{
+    uint64_t hi = (uint64_t)(uint32_t)(cycles >> 32) * ns_mult;
+    uint64_t lo = (uint64_t)(uint32_t)cycles * ns_mult;
+
+    return (hi << (32 - NS_SHIFT)) + (lo >> NS_SHIFT);
+}
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+int ktime_init()
+{
+    // Read back the actual core clock from the RCC
+    SystemCoreClockUpdate();
+
+    uint32_t period = SystemCoreClock / HZ;
+    if (period == 0 || period > MAX_PERIOD)
+        return -1;
+
+    // The multiplier must fit in 32 bits, this is
+    //   the case for any clock above 4 MHz
+    uint64_t mult = (NS_PER_SEC << NS_SHIFT) / SystemCoreClock;
+    if (mult > UINT32_MAX)
+        return -1;
+
+    tick_cycles = period;
+    tick_ns = ((uint64_t)period * NS_PER_SEC) / SystemCoreClock;
+    ns_mult = (uint32_t)mult;
+
+    ticks = 0;
+
+    systick_init(period - 1);
+    dwt_init();
+
+    kvsys_update_time(0, 0, DWT_CYCCNT, ns_mult);
+
+    return 0;
+}
+
+void ktime_tick()
+{
+    ++ticks;
+
+    // The new period started (tick_cycles - 1 - VAL) cycles ago
+    uint32_t cycles = DWT_CYCCNT;
+    uint32_t elapsed = (tick_cycles - 1) - SysTick->VAL;
+    kvsys_update_time(ticks, ticks * tick_ns, cycles - elapsed, ns_mult);
+}
+
+uint64_t ktime_ticks()
+{
+    return read_ticks();
+}
+
+uint64_t ktime_now_cycles()
+{
+    uint64_t now_ticks;
+    uint32_t elapsed = elapsed_in_tick(&now_ticks);
+
+    return now_ticks * tick_cycles + elapsed;
+}
+
+uint64_t ktime_now()
+{
+    uint64_t now_ticks;
+    uint32_t elapsed = elapsed_in_tick(&now_ticks);
+
+    return now_ticks * tick_ns + scale(elapsed);
+}
+
+uint64_t ktime_cycles_to_ns(uint64_t cycles)
+{
+    return scale(cycles);
+}
+
+uint64_t ktime_ns_to_ticks(uint64_t ns)
+{
+    if (!tick_ns)
+        return 0;
+
+    return (ns + tick_ns - 1) / tick_ns;
+}
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(ktime_ticks);
+EXPORT_KSYMBOL(ktime_now_cycles);
+EXPORT_KSYMBOL(ktime_now);
+EXPORT_KSYMBOL(ktime_cycles_to_ns);
+EXPORT_KSYMBOL(ktime_ns_to_ticks);
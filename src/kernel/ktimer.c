@@ -0,0 +1,370 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "kernel/ktimer.h"
+#include "kernel/ksymbols.h"
+#include "kernel/ksched.h"
+#include "kernel/kmalloc.h"
+#include "kernel/kcrit.h"
+
+///////////////////////////
+//// Module parameters ////
+///////////////////////////
+
+//! Number of levels in the timer wheel
+#define LEVELS 4
+
+//! Each level of the wheel has 2^LEVEL_BITS slots
+#define LEVEL_BITS 6
+
+////////////////////////////////
+//// Module's sanity checks ////
+////////////////////////////////
+
+#if (LEVELS * LEVEL_BITS) > 31
+#error "Timer wheel is too big for a 32-bit tick counter"
+#endif
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! Number of slots per level
+#define LEVEL_SLOTS (1 << LEVEL_BITS)
+
+//! Mask to get a slot index in a level
+#define LEVEL_MASK (LEVEL_SLOTS - 1)
+
+//! Longest delay (in ticks) the wheel can hold
+#define MAX_DELAY ((1 << (LEVELS * LEVEL_BITS)) - 1)
+
+//! Timer states
+enum
+{
+    //! The timer is not armed
+    TS_STOPPED = 0x00,
+    //! The timer is waiting in the wheel
+    TS_ARMED = 0x01,
+    //! The timer expired, its callback is pending
+    TS_EXPIRED = 0x02
+};
+
+//! The kernel software timer structure
+struct ktimer
+{
+    //! Function called when the timer expires
+    void (*callback)(void*);
+    //! Argument to give to the callback
+    void* arg;
+    //! Creation flags (see KTIMER_*)
+    int flags;
+
+    //! Delay (or period) in ticks
+    int period;
+    //! Absolute tick at which the timer expires
+    uint32_t expires;
+    //! Current state of the timer (see TS_*)
+    int state;
+
+    //! Next timer in the same list
+    struct ktimer* next;
+    //! Address of the pointer to this timer in its list,
+    //!   so that it can be unlinked in constant time
+    struct ktimer** pprev;
+};
+
+///////////////////////////////////////
+//// Module's forward declarations ////
+///////////////////////////////////////
+
+static void list_add(struct ktimer** head, struct ktimer* timer);
+static void list_del(struct ktimer* timer);
+static void enqueue(struct ktimer* timer);
+static void cascade(int level, int index);
+static void service(void* arg);
+
+/////////////////////////////////////
+//// Module's internal variables ////
+/////////////////////////////////////
+
+//! The timer wheel, level 0 slots hold timers expiring
+//!   in the next LEVEL_SLOTS ticks, each upper level slot
+//!   spans a whole lower level turn
+static struct ktimer* wheel[LEVELS][LEVEL_SLOTS];
+
+//! Next tick to be processed by the wheel
+static uint32_t wheel_time = 0;
+
+//! Expired timers whose callback is pending
+static struct ktimer* expired = 0;
+
+//! The timer service thread
+static struct ktask* service_task = 0;
+
+/////////////////////////////////////
+//// Module's internal functions ////
+/////////////////////////////////////
+
+//! Insert a timer at the head of a list
+//! \param head The list to insert into
+//! \param timer The timer to insert
+static void list_add(struct ktimer** head, struct ktimer* timer)
+{
+    timer->next = *head;
+    if (*head)
+        (*head)->pprev = &timer->next;
+
+    *head = timer;
+    timer->pprev = head;
+}
+
+//! Unlink a timer from its list
+//! \param timer The timer to unlink
+static void list_del(struct ktimer* timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+
+    timer->next = 0;
+    timer->pprev = 0;
+}
+
+//! Put an armed timer in the right slot of the wheel,
+//!   this must be called inside a critical section
+//! \param timer The timer to insert
+static void enqueue(struct ktimer* timer)
+{
+    uint32_t delta = timer->expires - wheel_time;
+
+    // Already late, fire it at the next tick
+    if ((int32_t)delta < 0)
+    {
+        list_add(&wheel[0][wheel_time & LEVEL_MASK], timer);
+        return;
+    }
+
+    // Find the lowest level that spans the delay
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1U << ((level + 1) * LEVEL_BITS)))
+        ++level;
+
+    int index = (timer->expires >> (level * LEVEL_BITS)) & LEVEL_MASK;
+    list_add(&wheel[level][index], timer);
+}
+
+//! Move all timers of an upper level slot
+//!   down the wheel, now that their expiry is near
+//! \param level The level of the slot
+//! \param index The index of the slot in its level
+static void cascade(int level, int index)
+{
+    struct ktimer* timer = wheel[level][index];
+    wheel[level][index] = 0;
+
+    while (timer)
+    {
+        struct ktimer* next = timer->next;
+        enqueue(timer);
+        timer = next;
+    }
+}
+
+//! Timer service thread, runs the expired timers'
+//!   callbacks and re-arms periodic ones
+//! \param arg Unused
+static void service(void* arg)
+{
+    (void)arg;
+
+    for (;;)
+    {
+        void (*callback)(void*) = 0;
+        void* cb_arg = 0;
+
+        uint32_t crit = kcrit_enter();
+        struct ktimer* timer = expired;
+        if (timer)
+        {
+            list_del(timer);
+
+            if (timer->flags & KTIMER_PERIODIC)
+            {
+                // Stay in phase with the original expiry
+                timer->expires += timer->period;
+                timer->state = TS_ARMED;
+                enqueue(timer);
+            }
+            else
+            {
+                timer->state = TS_STOPPED;
+            }
+
+            // The timer may be destroyed as soon
+            //   as we leave the critical section
+            callback = timer->callback;
+            cb_arg = timer->arg;
+        }
+        else
+        {
+            ksched_sleep();
+        }
+        kcrit_exit(crit);
+
+        if (callback)
+            callback(cb_arg);
+    }
+}
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+int ktimer_init()
+{
+    if (service_task)
+        return -1;
+
+    int pid = ksched_spawn("[ktimer]", (void*)&service, 0);
+    if (pid < 0)
+        return -1;
+
+    if (ksched_set_priority(pid, KSCHED_PRIO_MAX) < 0)
+        return -1;
+
+    service_task = ksched_task_by_pid(pid);
+
+    return 0;
+}
+
+ktimer* ktimer_create(void (*callback)(void*), void* arg, int flags)
+{
+    if (!callback)
+        return 0;
+
+    struct ktimer* timer = kmalloc(sizeof(struct ktimer));
+    if (!timer)
+        return 0;
+
+    timer->callback = callback;
+    timer->arg = arg;
+    timer->flags = flags;
+    timer->period = 0;
+    timer->expires = 0;
+    timer->state = TS_STOPPED;
+    timer->next = 0;
+    timer->pprev = 0;
+
+    return timer;
+}
+
+int ktimer_start(ktimer* timer, int ticks)
+{
+    if (!timer || ticks <= 0)
+        return -1;
+
+    if (ticks > MAX_DELAY)
+        ticks = MAX_DELAY;
+
+    uint32_t crit = kcrit_enter();
+
+    if (timer->state != TS_STOPPED)
+        list_del(timer);
+
+    timer->period = ticks;
+    timer->expires = wheel_time + ticks;
+    timer->state = TS_ARMED;
+    enqueue(timer);
+
+    kcrit_exit(crit);
+
+    return 0;
+}
+
+int ktimer_stop(ktimer* timer)
+{
+    if (!timer)
+        return -1;
+
+    uint32_t crit = kcrit_enter();
+
+    if (timer->state != TS_STOPPED)
+        list_del(timer);
+    timer->state = TS_STOPPED;
+
+    kcrit_exit(crit);
+
+    return 0;
+}
+
+void ktimer_destroy(ktimer* timer)
+{
+    if (!timer)
+        return;
+
+    ktimer_stop(timer);
+    kfree(timer);
+}
+
+void ktimer_tick()
+{
+    uint32_t crit = kcrit_enter();
+
+    // When the level 0 index wraps around, bring down
+    //   the next slot of the upper level(s)
+    int index = wheel_time & LEVEL_MASK;
+    int upper = index;
+    for (int level = 1; level < LEVELS && upper == 0; ++level)
+    {
+        upper = (wheel_time >> (level * LEVEL_BITS)) & LEVEL_MASK;
+        cascade(level, upper);
+    }
+
+    // Everything in the current slot expires now
+    struct ktimer* timer = wheel[0][index];
+    wheel[0][index] = 0;
+
+    int fired = 0;
+    while (timer)
+    {
+        struct ktimer* next = timer->next;
+
+        timer->state = TS_EXPIRED;
+        list_add(&expired, timer);
+        fired = 1;
+
+        timer = next;
+    }
+
+    ++wheel_time;
+
+    // Callbacks run in the service thread
+    if (fired && service_task)
+        ksched_wakeup(service_task);
+
+    kcrit_exit(crit);
+}
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(ktimer_create);
+EXPORT_KSYMBOL(ktimer_start);
+EXPORT_KSYMBOL(ktimer_stop);
+EXPORT_KSYMBOL(ktimer_destroy);
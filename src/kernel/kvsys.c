@@ -0,0 +1,90 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "kernel/kvsys.h"
+#include "kernel/ksymbols.h"
+#include "kernel/kcrit.h"
+
+/////////////////////////////////////
+//// Module's internal variables ////
+/////////////////////////////////////
+
+//! The vsys block, aligned so that an MPU
+//!   region can map it read-only
+static struct kvsys vsys __attribute__((aligned(32))) = {0};
+
+/////////////////////////////////////
+//// Module's internal functions ////
+/////////////////////////////////////
+
+//! Start an update of the vsys block, must be
+//!   called from within a critical section (writers
+//!   can be nested interrupt handlers)
+static inline void write_begin()
+{
+    vsys.seq++;
+    asm volatile("dmb" : : : "memory");
+}
+
+//! Finish an update of the vsys block
+static inline void write_end()
+{
+    asm volatile("dmb" : : : "memory");
+    vsys.seq++;
+}
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+const struct kvsys* kvsys_get()
+{
+    return &vsys;
+}
+
+void kvsys_update_time(uint64_t ticks, uint64_t base_ns, uint32_t base_cycles, uint32_t ns_mult)
+{
+    uint32_t crit = kcrit_enter();
+    write_begin();
+
+    vsys.ticks = ticks;
+    vsys.base_ns = base_ns;
+    vsys.base_cycles = base_cycles;
+    vsys.ns_mult = ns_mult;
+
+    write_end();
+    kcrit_exit(crit);
+}
+
+void kvsys_update_task(int pid)
+{
+    uint32_t crit = kcrit_enter();
+    write_begin();
+
+    vsys.pid = pid;
+    vsys.generation++;
+
+    write_end();
+    kcrit_exit(crit);
+}
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(kvsys_get);
@@ -0,0 +1,204 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "kernel/kwork.h"
+#include "kernel/ksymbols.h"
+#include "kernel/ksched.h"
+#include "kernel/kcrit.h"
+
+///////////////////////////
+//// Module parameters ////
+///////////////////////////
+
+//! Number of pending work items each
+//!   queue can hold (must be a power of 2)
+#define QUEUE_SIZE 16
+
+////////////////////////////////
+//// Module's sanity checks ////
+////////////////////////////////
+
+#if (QUEUE_SIZE & (QUEUE_SIZE - 1)) != 0
+#error "Work queue size must be a power of 2"
+#endif
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! A deferred work item
+struct work
+{
+    //! The callback to run
+    void (*fn)(void*);
+    //! The argument to pass to the callback
+    void* arg;
+};
+
+//! A work queue, that is a ring buffer
+//!   of work items serviced by a single worker
+struct queue
+{
+    //! Pending work items
+    struct work items[QUEUE_SIZE];
+    //! Index of the next item to run
+    uint32_t head;
+    //! Index of the next free slot
+    uint32_t tail;
+    //! The worker thread servicing this queue
+    struct ktask* worker;
+    //! Number of work items dropped because
+    //!   the queue was full
+    int dropped;
+};
+
+///////////////////////////////////////
+//// Module's forward declarations ////
+///////////////////////////////////////
+
+static int push(struct queue* q, void (*fn)(void*), void* arg);
+static int pop(struct queue* q, struct work* w);
+static void worker(void* arg);
+
+/////////////////////////////////////
+//// Module's internal variables ////
+/////////////////////////////////////
+
+//! The work queues, by level
+static struct queue queues[KWORK_LEVELS];
+
+//! Scheduling priority of each level's worker
+static const int worker_prio[KWORK_LEVELS] = {KSCHED_PRIO_MAX - 1, KSCHED_PRIO_DEFAULT + 2, KSCHED_PRIO_MIN + 1};
+
+//! Name of each level's worker
+static const char* worker_name[KWORK_LEVELS] = {"[kwork/high]", "[kwork/normal]", "[kwork/low]"};
+
+/////////////////////////////////////
+//// Module's internal functions ////
+/////////////////////////////////////
+
+//! Append a work item to a queue, this must
+//!   be called inside a critical section
+//! \param q The queue to append to
+//! \param fn The callback to run
+//! \param arg The argument to pass to the callback
+//! \return 0 if OK, -1 if the queue is full
+static int push(struct queue* q, void (*fn)(void*), void* arg)
+{
+    if (q->tail - q->head >= QUEUE_SIZE)
+    {
+        ++q->dropped;
+        return -1;
+    }
+
+    struct work* w = q->items + (q->tail & (QUEUE_SIZE - 1));
+    w->fn = fn;
+    w->arg = arg;
+    ++q->tail;
+
+    return 0;
+}
+
+//! Take the oldest work item from a queue, this must
+//!   be called inside a critical section
+//! \param q The queue to read from
+//! \param w Output parameter for the work item
+//! \return 1 if an item was taken, 0 if the queue is empty
+static int pop(struct queue* q, struct work* w)
+{
+    if (q->head == q->tail)
+        return 0;
+
+    *w = q->items[q->head & (QUEUE_SIZE - 1)];
+    ++q->head;
+
+    return 1;
+}
+
+//! Worker thread main loop, runs queued work
+//!   items and sleeps when there is nothing to do
+//! \param arg The queue to service
+static void worker(void* arg)
+{
+    struct queue* q = (struct queue*)arg;
+
+    for (;;)
+    {
+        struct work w;
+
+        // Checking the queue and going to sleep is
+        //   atomic, so that no wakeup can be lost
+        uint32_t crit = kcrit_enter();
+        int got = pop(q, &w);
+        if (!got)
+            ksched_sleep();
+        kcrit_exit(crit);
+
+        if (got)
+            w.fn(w.arg);
+    }
+}
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+int kwork_init()
+{
+    for (int i = 0; i < KWORK_LEVELS; ++i)
+    {
+        struct queue* q = queues + i;
+        q->head = q->tail = 0;
+        q->dropped = 0;
+
+        int pid = ksched_spawn(worker_name[i], (void*)&worker, q);
+        if (pid < 0)
+            return -1;
+
+        if (ksched_set_priority(pid, worker_prio[i]) < 0)
+            return -1;
+
+        q->worker = ksched_task_by_pid(pid);
+    }
+
+    return 0;
+}
+
+int kwork_queue(int level, void (*fn)(void*), void* arg)
+{
+    if (level < 0 || level >= KWORK_LEVELS || !fn)
+        return -1;
+
+    struct queue* q = queues + level;
+    if (!q->worker)
+        return -1;
+
+    uint32_t crit = kcrit_enter();
+    int err = push(q, fn, arg);
+    if (err == 0)
+        ksched_wakeup(q->worker);
+    kcrit_exit(crit);
+
+    return err;
+}
+
+//////////////////////////
+//// Exported symbols ////
+//////////////////////////
+
+EXPORT_KSYMBOL(kwork_queue);
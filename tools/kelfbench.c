@@ -0,0 +1,290 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// kelfbench : time the kernel's module loader (src/kernel/kelf.c,
+//   compiled for the host) on module files, loading, linking and
+//   unloading each one many times. External symbols all resolve to
+//   the same fake kernel function, and prelinked images (see
+//   kmodimg.h) are taken as linked against the running kernel. With
+//   -x, modules are executed in place and the blob is checked to be
+//   restored after each unload.
+//
+// Usage: kelfbench [-x] [-n <loads>] <module>...
+//
+// This runs on the (little-endian) build host, allocations are kept
+//   below 4 GiB so that they fit in the loader's 32-bit addresses.
+
+#define _GNU_SOURCE
+#include "kernel/kelf.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/mman.h>
+
+///////////////////////////
+//// Module parameters ////
+///////////////////////////
+
+//! Size of the memory pool the loader allocates from
+#define POOL_SIZE (16 << 20)
+
+//! Default number of loads of each module
+#define DEFAULT_LOADS 1000
+
+//! Address every external symbol resolves to (a
+//!   Thumb function in flash)
+#define FAKE_SYMBOL 0x08000101
+
+////////////////////////////////
+//// Module's sanity checks ////
+////////////////////////////////
+
+#ifndef MAP_32BIT
+#error "kelfbench needs allocations below 4 GiB (MAP_32BIT)"
+#endif
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! Header of an allocated block
+struct block
+{
+    uint32_t size;
+    uint32_t pad;
+};
+
+/////////////////////////////////////
+//// Module's internal variables ////
+/////////////////////////////////////
+
+//! The memory pool, how much of it is used, and how
+//!   much of it holds the module being loaded
+static char* pool = 0;
+static uint32_t pool_used = 0;
+static uint32_t pool_kept = 0;
+
+//! Highest pool usage of a load
+static uint32_t pool_peak = 0;
+
+//! Checksum of the kernel symbol table, as seen by the loader
+static uint32_t ksymtab_sum = 0;
+
+/////////////////////////////////////
+//// Module's internal functions ////
+/////////////////////////////////////
+
+//! Allocate from the pool, the loader releases all its blocks
+//!   on unload so the pool is simply reset between loads
+static void* pool_alloc(uint32_t size)
+{
+    uint32_t total = sizeof(struct block) + ((size + 7) & ~7u);
+    if (POOL_SIZE - pool_used < total)
+        return 0;
+
+    struct block* b = (struct block*)(pool + pool_used);
+    b->size = size;
+    pool_used += total;
+    if (pool_used > pool_peak)
+        pool_peak = pool_used;
+
+    return b + 1;
+}
+
+//! Read a whole file at the start of the pool, so that it is
+//!   within branch range of what the loader allocates (as it is
+//!   on target, where everything fits in RAM)
+static char* read_file(const char* path, long* size)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return 0;
+
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    pool_used = 0;
+    char* data = *size > 0 ? pool_alloc((uint32_t)*size) : 0;
+    if (data && fread(data, 1, *size, f) != (size_t)*size)
+        data = 0;
+    pool_kept = pool_used;
+
+    fclose(f);
+    return data;
+}
+
+//! Current time, in nanoseconds
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//! Load, link and unload a module many times
+//! \return 0 if OK, -1 otherwise
+static int bench(const char* path, int loads, int xip)
+{
+    long size;
+    char* data = read_file(path, &size);
+    char* copy = malloc(size);
+    if (!data || !copy)
+    {
+        fprintf(stderr, "kelfbench: unable to read '%s'\n", path);
+        return -1;
+    }
+    memcpy(copy, data, size);
+
+    // Accept prelinked images whatever kernel they were linked against
+    const struct kmodimg_header* image = (const struct kmodimg_header*)data;
+    if (size >= (long)sizeof(struct kmodimg_header) && image->magic == KMODIMG_MAGIC)
+        ksymtab_sum = image->ksymtab_sum;
+
+    pool_peak = pool_kept;
+    double start = now_ns();
+
+    for (int i = 0; i < loads; ++i)
+    {
+        pool_used = pool_kept;
+
+        kelf* elf = kelf_load(data, xip ? KELF_F_XIP : 0);
+        if (!elf || kelf_needs_fix(elf) || kelf_finalize(elf) < 0)
+        {
+            fprintf(stderr, "kelfbench: unable to load '%s'\n", path);
+            return -1;
+        }
+
+        kelf_unload(elf);
+
+        if (xip && memcmp(data, copy, size))
+        {
+            fprintf(stderr, "kelfbench: '%s' not restored after unload\n", path);
+            return -1;
+        }
+    }
+
+    double elapsed = now_ns() - start;
+    printf("%s: %d loads, %.2f us per load, %u bytes allocated\n", path, loads, elapsed / loads / 1000.0,
+           (unsigned)(pool_peak - pool_kept));
+
+    free(copy);
+
+    return 0;
+}
+
+///////////////////////////////////
+//// Kernel services for kelf ////
+///////////////////////////////////
+
+void* kmalloc(int size)
+{
+    return size < 0 ? 0 : pool_alloc((uint32_t)size);
+}
+
+void* krealloc(void* ptr, int size)
+{
+    void* p = kmalloc(size);
+    if (p && ptr)
+    {
+        uint32_t old = ((struct block*)ptr - 1)->size;
+        memcpy(p, ptr, old < (uint32_t)size ? old : (uint32_t)size);
+    }
+
+    return p;
+}
+
+void kfree(void* ptr)
+{
+    (void)ptr;
+}
+
+void* ksymbol(const char* name)
+{
+    (void)name;
+    return (void*)FAKE_SYMBOL;
+}
+
+uint32_t ksymtab_checksum()
+{
+    return ksymtab_sum;
+}
+
+void kprint(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+// Lazy binding is not benchmarked, its stubs are never called
+void kelf_lazy_resolve()
+{
+}
+
+int ksched_getpid()
+{
+    return -1;
+}
+
+int ksched_exit()
+{
+    return -1;
+}
+
+/////////////////////////////
+//// Public module's API ////
+/////////////////////////////
+
+int main(int argc, char** argv)
+{
+    int loads = DEFAULT_LOADS;
+    int xip = 0;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; ++i)
+    {
+        if (!strcmp(argv[i], "-x"))
+            xip = 1;
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            loads = atoi(argv[++i]);
+        else
+            break;
+    }
+
+    if (i == argc || loads <= 0)
+    {
+        fprintf(stderr, "usage: %s [-x] [-n <loads>] <module>...\n", argv[0]);
+        return 1;
+    }
+
+    pool = mmap(0, POOL_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (pool == MAP_FAILED)
+    {
+        fprintf(stderr, "kelfbench: unable to allocate the memory pool\n");
+        return 1;
+    }
+
+    int err = 0;
+    for (; i < argc; ++i)
+        err |= bench(argv[i], loads, xip) < 0;
+
+    return err;
+}
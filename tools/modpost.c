@@ -0,0 +1,1368 @@
+/*
+ * alOS
+ * Copyright (C) 2015 Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// modpost : prelink a kernel module against the kernel ELF, producing
+//   an image in the kmodimg.h format. Relocations against exported
+//   kernel symbols and between the module's own sections are applied
+//   here, only the ones depending on the load address are kept (as a
+//   fixup stream), and symbols that are neither in the module nor in
+//   the kernel's link-time symbol table (symbols registered by other
+//   modules) are left as imports.
+// When a module can't be prelinked, it is kept as an ELF module that
+//   the kernel links at load time, compacted : sections and local symbols
+//   the kernel does not need are dropped, and string tables are merged.
+//
+// Usage: modpost [-W] <kernel elf> <module> <output>
+//        modpost -c <module> <output>    (compaction only)
+//   With -W, a module that can't be prelinked is an error instead
+//   of a warning.
+//
+// This runs on the (little-endian) build host.
+
+#include "kernel/elf32.h"
+#include "kernel/kmodimg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+///////////////////////////
+//// Module parameters ////
+///////////////////////////
+
+//! Size of a branch veneer (ldr.w pc, [pc, #0] + address)
+#define VENEER_SIZE 8
+
+////////////////////////////////
+//// Module's sanity checks ////
+////////////////////////////////
+
+#ifndef KMALLOC_ALIGNMENT
+#error "KMALLOC_ALIGNMENT must be defined (build with the kernel's DEFINES)"
+#endif
+
+//////////////////////////////
+//// Module's definitions ////
+//////////////////////////////
+
+//! A file loaded in memory
+struct blob
+{
+    char* data;
+    long size;
+};
+
+//! A growable array
+struct array
+{
+    void* data;
+    int count;
+    int capacity;
+    int elsize;
+};
+
+//! A fixup of the image (see KMODIMG_FIX_*)
+struct fixup
+{
+    uint32_t offset;
+    uint32_t kind;
+    uint32_t low;
+};
+
+//! An import of the image
+struct import
+{
+    const char* name;
+    uint32_t offset;
+};
+
+//! A branch veneer
+struct veneer
+{
+    elf32_word sym;
+    uint32_t offset;
+};
+
+//! A string of the merged string table
+struct string
+{
+    const char* str;
+    int len;
+    //! Where to write its offset in the table
+    elf32_word* dest;
+};
+
+//! The kernel being linked against
+struct kernel
+{
+    struct blob blob;
+    elf32_header* header;
+    //! The .ksymtab section contents
+    elf32_word* ksymtab;
+    int ksymtab_count;
+    uint32_t ksymtab_sum;
+};
+
+//! The module being prelinked
+struct module
+{
+    struct blob blob;
+    elf32_header* header;
+    elf32_shdr* symtab;
+    elf32_shdr* symstrtab;
+
+    //! Offset of each section in the image (-1 if not loaded)
+    int32_t* shoff;
+
+    uint8_t* image;
+    uint32_t copy_size;
+    uint32_t load_size;
+
+    struct array fixups;
+    struct array imports;
+    struct array veneers;
+};
+
+///////////////////////////////////////
+//// Module's forward declarations ////
+///////////////////////////////////////
+
+static void* push(struct array* a);
+static int read_blob(const char* path, struct blob* blob);
+static int write_blob(const char* path, const void* data, long size);
+static elf32_shdr* section(elf32_header* header, elf32_word id);
+static const char* section_name(elf32_header* header, elf32_shdr* shdr);
+static const char* kernel_string(struct kernel* k, elf32_addr addr);
+static int load_kernel(struct kernel* k);
+static int kernel_symbol(struct kernel* k, const char* name, elf32_addr* location);
+static elf32_sym* symbol(struct module* m, elf32_word id);
+static const char* symbol_name(struct module* m, elf32_sym* sym);
+static int is_call(elf32_word r_type);
+static int layout(struct module* m);
+static uint32_t* veneer_for(struct module* m, elf32_word sym);
+static elf32_word get32(struct module* m, uint32_t off);
+static void set32(struct module* m, uint32_t off, elf32_word value);
+static elf32_half get16(struct module* m, uint32_t off);
+static void set16(struct module* m, uint32_t off, elf32_half value);
+static elf32_word mov_get(struct module* m, uint32_t off);
+static void mov_set(struct module* m, uint32_t off, elf32_word value);
+static int branch(struct module* m, uint32_t P, uint32_t S);
+static int short_branch(struct module* m, uint32_t P, uint32_t S, int bits);
+static int add_fixup(struct module* m, uint32_t offset, uint32_t kind, uint32_t low);
+static int add_import(struct module* m, const char* name, uint32_t offset);
+static int relocate(struct kernel* k, struct module* m, elf32_shdr* shdr, elf32_rel* rel);
+static int prelink(struct kernel* k, struct module* m);
+static int emit(struct kernel* k, struct module* m, const char* path);
+static int string_cmp(const void* a, const void* b);
+static int add_string(struct array* strings, const char* str, elf32_word* dest);
+static int merge_strings(struct array* strings, struct array* strtab);
+static int compact(const struct blob* in, struct blob* out);
+static int write_compacted(struct blob* module, const char* path);
+
+/////////////////////////////////////
+//// Module's internal functions ////
+/////////////////////////////////////
+
+//! Append an element to an array
+//! \param a The array
+//! \return The new (zeroed) element, 0 on allocation failure
+static void* push(struct array* a)
+{
+    if (a->count == a->capacity)
+    {
+        int capacity = a->capacity ? 2 * a->capacity : 16;
+        void* data = realloc(a->data, capacity * a->elsize);
+        if (!data)
+            return 0;
+
+        a->data = data;
+        a->capacity = capacity;
+    }
+
+    void* el = (char*)a->data + a->count++ * a->elsize;
+    memset(el, 0, a->elsize);
+
+    return el;
+}
+
+//! Read a whole file
+//! \param path The file's path
+//! \param blob The blob to fill
+//! \return 0 on success, -1 otherwise
+static int read_blob(const char* path, struct blob* blob)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return -1;
+
+    fseek(f, 0, SEEK_END);
+    blob->size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    blob->data = malloc(blob->size ? blob->size : 1);
+    int ok = blob->data && fread(blob->data, 1, blob->size, f) == (size_t)blob->size;
+
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+//! Write a whole file
+//! \param path The file's path
+//! \param data The data to write
+//! \param size The data's size
+//! \return 0 on success, -1 otherwise
+static int write_blob(const char* path, const void* data, long size)
+{
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return -1;
+
+    int ok = fwrite(data, 1, size, f) == (size_t)size;
+
+    return (fclose(f) == 0 && ok) ? 0 : -1;
+}
+
+//! Get a section header
+//! \param header The ELF header
+//! \param id The section's index
+//! \return The section's header, 0 if out of bounds
+static elf32_shdr* section(elf32_header* header, elf32_word id)
+{
+    if (id >= header->e_shnum)
+        return 0;
+
+    return (elf32_shdr*)((char*)header + header->e_shoff + id * header->e_shentsize);
+}
+
+//! Get a section's name
+//! \param header The ELF header
+//! \param shdr The section's header
+//! \return The section's name
+static const char* section_name(elf32_header* header, elf32_shdr* shdr)
+{
+    elf32_shdr* shstrtab = section(header, header->e_shstrndx);
+    if (!shstrtab)
+        return "";
+
+    return (const char*)header + shstrtab->sh_offset + shdr->sh_name;
+}
+
+//! Get a string from the kernel's memory image
+//! \param k The kernel
+//! \param addr The string's address
+//! \return The string, 0 if not found
+static const char* kernel_string(struct kernel* k, elf32_addr addr)
+{
+    for (elf32_word i = 0; i < k->header->e_shnum; ++i)
+    {
+        elf32_shdr* shdr = section(k->header, i);
+        if (!(shdr->sh_flags & SHF_ALLOC) || shdr->sh_type != SHT_PROGBITS)
+            continue;
+
+        if (addr >= shdr->sh_addr && addr < shdr->sh_addr + shdr->sh_size)
+            return k->blob.data + shdr->sh_offset + (addr - shdr->sh_addr);
+    }
+
+    return 0;
+}
+
+//! Find the kernel's link-time symbol table, and compute its checksum
+//!   the same way ksymtab_checksum() does
+//! \param k The kernel
+//! \return 0 on success, -1 otherwise
+static int load_kernel(struct kernel* k)
+{
+    k->header = (elf32_header*)k->blob.data;
+    if (k->blob.size < EEH_SIZE || memcmp(k->header->e_ident, elf32_magic, 4) || k->header->e_type != ET_EXEC)
+        return -1;
+
+    for (elf32_word i = 0; i < k->header->e_shnum; ++i)
+    {
+        elf32_shdr* shdr = section(k->header, i);
+        if (strcmp(section_name(k->header, shdr), ".ksymtab") != 0)
+            continue;
+
+        k->ksymtab = (elf32_word*)(k->blob.data + shdr->sh_offset);
+        k->ksymtab_count = shdr->sh_size / (2 * sizeof(elf32_word));
+
+        k->ksymtab_sum = 2166136261u;
+        for (elf32_word j = 0; j < shdr->sh_size; ++j)
+            k->ksymtab_sum = (k->ksymtab_sum ^ (uint8_t)k->blob.data[shdr->sh_offset + j]) * 16777619u;
+
+        return 0;
+    }
+
+    return -1;
+}
+
+//! Look up a symbol in the kernel's link-time symbol table
+//! \param k The kernel
+//! \param name The symbol's name
+//! \param location Where to store the symbol's location
+//! \return 0 if found, -1 otherwise
+static int kernel_symbol(struct kernel* k, const char* name, elf32_addr* location)
+{
+    for (int i = 0; i < k->ksymtab_count; ++i)
+    {
+        const char* kname = kernel_string(k, k->ksymtab[2 * i]);
+        if (kname && strcmp(kname, name) == 0)
+        {
+            *location = k->ksymtab[2 * i + 1];
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+//! Get a module's symbol
+//! \param m The module
+//! \param id The symbol's index
+//! \return The symbol, 0 if out of bounds
+static elf32_sym* symbol(struct module* m, elf32_word id)
+{
+    if (id >= m->symtab->sh_size / m->symtab->sh_entsize)
+        return 0;
+
+    return (elf32_sym*)(m->blob.data + m->symtab->sh_offset + id * m->symtab->sh_entsize);
+}
+
+//! Get a module's symbol name
+//! \param m The module
+//! \param sym The symbol
+//! \return The symbol's name
+static const char* symbol_name(struct module* m, elf32_sym* sym)
+{
+    return m->blob.data + m->symstrtab->sh_offset + sym->st_name;
+}
+
+//! Check if a relocation is a Thumb call or jump
+//! \param r_type The relocation's type
+//! \return 1 if so, 0 otherwise
+static int is_call(elf32_word r_type)
+{
+    return r_type == R_ARM_THM_CALL || r_type == R_ARM_THM_JUMP24;
+}
+
+//! Lay out the module's sections in the image : contents first,
+//!   then the branch veneers, then zero-initialized sections
+//! \param m The module
+//! \return 0 on success, -1 otherwise
+static int layout(struct module* m)
+{
+    m->shoff = malloc(m->header->e_shnum * sizeof(int32_t));
+    if (!m->shoff)
+        return -1;
+
+    for (elf32_word i = 0; i < m->header->e_shnum; ++i)
+        m->shoff[i] = -1;
+
+    uint32_t off = 0;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (elf32_word i = 0; i < m->header->e_shnum; ++i)
+        {
+            elf32_shdr* shdr = section(m->header, i);
+            if (!(shdr->sh_flags & SHF_ALLOC))
+                continue;
+            if ((shdr->sh_type == SHT_NOBITS) != (pass == 1))
+                continue;
+            if (pass == 0 && shdr->sh_type != SHT_PROGBITS && shdr->sh_type != SHT_ARM_EXIDX)
+            {
+                fprintf(stderr, "modpost: section '%s' has an unsupported type (%u)\n",
+                        section_name(m->header, shdr), (unsigned)shdr->sh_type);
+                return -1;
+            }
+
+            elf32_word align = shdr->sh_addralign < 4 ? 4 : shdr->sh_addralign;
+            if (align > KMALLOC_ALIGNMENT)
+            {
+                fprintf(stderr, "modpost: section '%s' needs a %u bytes alignment\n", section_name(m->header, shdr),
+                        (unsigned)align);
+                return -1;
+            }
+
+            off = (off + align - 1) & ~(align - 1);
+            m->shoff[i] = off;
+            off += shdr->sh_size;
+        }
+
+        // One veneer per external symbol called by the module
+        if (pass == 0)
+        {
+            off = KMODIMG_ALIGN(off);
+
+            for (elf32_word i = 0; i < m->header->e_shnum; ++i)
+            {
+                elf32_shdr* shdr = section(m->header, i);
+                if (shdr->sh_type != SHT_REL)
+                    continue;
+
+                for (elf32_word j = 0; j < shdr->sh_size / shdr->sh_entsize; ++j)
+                {
+                    elf32_rel* rel = (elf32_rel*)(m->blob.data + shdr->sh_offset + j * shdr->sh_entsize);
+                    elf32_sym* sym = symbol(m, ELF32_R_SYM(rel->r_info));
+                    if (!sym || sym->st_shndx != SHN_UNDEF || !is_call(ELF32_R_TYPE(rel->r_info)))
+                        continue;
+                    if (veneer_for(m, ELF32_R_SYM(rel->r_info)))
+                        continue;
+
+                    struct veneer* v = push(&m->veneers);
+                    if (!v)
+                        return -1;
+
+                    v->sym = ELF32_R_SYM(rel->r_info);
+                    v->offset = off;
+                    off += VENEER_SIZE;
+                }
+            }
+
+            m->copy_size = off;
+        }
+    }
+
+    m->load_size = off;
+
+    // Build the initialized part of the image
+    m->image = calloc(KMODIMG_ALIGN(m->copy_size) + 4, 1);
+    if (!m->image)
+        return -1;
+
+    for (elf32_word i = 0; i < m->header->e_shnum; ++i)
+    {
+        elf32_shdr* shdr = section(m->header, i);
+        if (m->shoff[i] >= 0 && shdr->sh_type != SHT_NOBITS)
+            memcpy(m->image + m->shoff[i], m->blob.data + shdr->sh_offset, shdr->sh_size);
+    }
+
+    for (int i = 0; i < m->veneers.count; ++i)
+        set32(m, ((struct veneer*)m->veneers.data)[i].offset, 0xf000f8df);
+
+    return 0;
+}
+
+//! Get the offset of the literal of a symbol's veneer
+//! \param m The module
+//! \param sym The symbol's index
+//! \return A pointer to the veneer's offset, 0 if there is none
+static uint32_t* veneer_for(struct module* m, elf32_word sym)
+{
+    struct veneer* v = m->veneers.data;
+
+    for (int i = 0; i < m->veneers.count; ++i)
+    {
+        if (v[i].sym == sym)
+            return &v[i].offset;
+    }
+
+    return 0;
+}
+
+//! Read a word from the image
+static elf32_word get32(struct module* m, uint32_t off)
+{
+    elf32_word value;
+    memcpy(&value, m->image + off, sizeof(value));
+    return value;
+}
+
+//! Write a word to the image
+static void set32(struct module* m, uint32_t off, elf32_word value)
+{
+    memcpy(m->image + off, &value, sizeof(value));
+}
+
+//! Read a half-word from the image
+static elf32_half get16(struct module* m, uint32_t off)
+{
+    elf32_half value;
+    memcpy(&value, m->image + off, sizeof(value));
+    return value;
+}
+
+//! Write a half-word to the image
+static void set16(struct module* m, uint32_t off, elf32_half value)
+{
+    memcpy(m->image + off, &value, sizeof(value));
+}
+
+//! Get the immediate of a Thumb MOVW / MOVT instruction
+static elf32_word mov_get(struct module* m, uint32_t off)
+{
+    elf32_half upper = get16(m, off);
+    elf32_half lower = get16(m, off + 2);
+
+    return ((upper & 0x000f) << 12) | ((upper & 0x0400) << 1) | ((lower & 0x7000) >> 4) | (lower & 0x00ff);
+}
+
+//! Set the immediate of a Thumb MOVW / MOVT instruction
+static void mov_set(struct module* m, uint32_t off, elf32_word value)
+{
+    elf32_half upper = get16(m, off);
+    elf32_half lower = get16(m, off + 2);
+
+    set16(m, off, (upper & 0xfbf0) | ((value & 0xf000) >> 12) | ((value & 0x0800) >> 1));
+    set16(m, off + 2, (lower & 0x8f00) | ((value & 0x0700) << 4) | (value & 0x00ff));
+}
+
+//! Relocate a 32-bit Thumb BL / B.W instruction (image offsets)
+//! \return 0 on success, -1 if out of range
+static int branch(struct module* m, uint32_t P, uint32_t S)
+{
+    elf32_half upper = get16(m, P);
+    elf32_half lower = get16(m, P + 2);
+
+    elf32_word s = (upper >> 10) & 1;
+    elf32_word j1 = (lower >> 13) & 1;
+    elf32_word j2 = (lower >> 11) & 1;
+
+    elf32_sword off = (s << 24) | ((~(j1 ^ s) & 1) << 23) | ((~(j2 ^ s) & 1) << 22) |
+                      ((upper & 0x03ff) << 12) | ((lower & 0x07ff) << 1);
+
+    if (off & 0x01000000)
+        off -= 0x02000000;
+
+    off += S - P;
+
+    if (off < -0x01000000 || off > 0x00fffffe)
+        return -1;
+
+    s = (off >> 24) & 1;
+    j1 = s ^ (~(off >> 23) & 1);
+    j2 = s ^ (~(off >> 22) & 1);
+
+    set16(m, P, (upper & 0xf800) | (s << 10) | ((off >> 12) & 0x03ff));
+    set16(m, P + 2, (lower & 0xd000) | (j1 << 13) | (j2 << 11) | ((off >> 1) & 0x07ff));
+
+    return 0;
+}
+
+//! Relocate a 16-bit Thumb B / B<cond> instruction (image offsets)
+//! \return 0 on success, -1 if out of range
+static int short_branch(struct module* m, uint32_t P, uint32_t S, int bits)
+{
+    elf32_half insn = get16(m, P);
+    elf32_half mask = (1 << bits) - 1;
+    elf32_sword sign = 1 << bits;
+
+    elf32_sword off = (insn & mask) << 1;
+    if (off & sign)
+        off -= sign << 1;
+
+    off += S - P;
+
+    if (off < -sign || off >= sign)
+        return -1;
+
+    set16(m, P, (insn & ~mask) | ((off >> 1) & mask));
+
+    return 0;
+}
+
+//! Record a location depending on the load address
+static int add_fixup(struct module* m, uint32_t offset, uint32_t kind, uint32_t low)
+{
+    struct fixup* f = push(&m->fixups);
+    if (!f)
+        return -1;
+
+    f->offset = offset;
+    f->kind = kind;
+    f->low = low;
+
+    return 0;
+}
+
+//! Record a word to which a symbol's address is added at load time
+static int add_import(struct module* m, const char* name, uint32_t offset)
+{
+    struct import* i = push(&m->imports);
+    if (!i)
+        return -1;
+
+    i->name = name;
+    i->offset = offset;
+
+    return 0;
+}
+
+//! Apply a relocation to the image
+//! \param k The kernel
+//! \param m The module
+//! \param shdr The relocation section
+//! \param rel The relocation
+//! \return 0 on success, -1 if it can't be prelinked
+static int relocate(struct kernel* k, struct module* m, elf32_shdr* shdr, elf32_rel* rel)
+{
+    elf32_word r_type = ELF32_R_TYPE(rel->r_info);
+    elf32_word r_sym = ELF32_R_SYM(rel->r_info);
+
+    if (r_type == R_ARM_V4BX)
+        return 0;
+
+    elf32_sym* sym = symbol(m, r_sym);
+    if (!sym)
+        return -1;
+
+    // Location to relocate, as an image offset
+    uint32_t P = m->shoff[shdr->sh_info] + rel->r_offset;
+
+    // Symbol value, and where it lives :
+    //   - in the image (S is an image offset, depends on the load address)
+    //   - in the kernel (S is absolute)
+    //   - unknown (import, resolved at load time)
+    elf32_word S = 0;
+    elf32_word T = 0;
+    int in_image = 0;
+    const char* import = 0;
+
+    if (sym->st_shndx == SHN_UNDEF)
+    {
+        const char* name = symbol_name(m, sym);
+
+        elf32_addr location;
+        if (kernel_symbol(k, name, &location) == 0)
+        {
+            S = location & ~0x01;
+            T = location & 0x01;
+        }
+        else
+            import = name;
+    }
+    else if (sym->st_shndx == SHN_ABS)
+    {
+        S = sym->st_value;
+    }
+    else
+    {
+        if (sym->st_shndx >= m->header->e_shnum || m->shoff[sym->st_shndx] < 0)
+            return -1;
+
+        in_image = 1;
+        T = ELF32_ST_TYPE(sym->st_info) == STT_FUNC ? 0x01 : 0x00;
+        S = (m->shoff[sym->st_shndx] + sym->st_value) & ~0x01;
+        if (ELF32_ST_TYPE(sym->st_info) == STT_SECTION)
+            T = 0;
+    }
+
+    // Calls to other modules or to the kernel go through a veneer,
+    //   the image can't be in range of flash anyway
+    if (is_call(r_type) && !in_image)
+    {
+        uint32_t* veneer = veneer_for(m, r_sym);
+        if (!veneer)
+            return -1;
+
+        if (import)
+        {
+            set32(m, *veneer + 4, 0);
+            if (add_import(m, import, *veneer + 4) < 0)
+                return -1;
+        }
+        else
+            set32(m, *veneer + 4, S | 0x01);
+
+        return branch(m, P, *veneer);
+    }
+
+    // Only words can be imported
+    if (import && r_type != R_ARM_ABS32 && r_type != R_ARM_TARGET1)
+        return -1;
+
+    switch (r_type)
+    {
+        case R_ARM_ABS32:
+        case R_ARM_TARGET1:
+            if (import)
+                return add_import(m, import, P);
+
+            set32(m, P, (S + get32(m, P)) | T);
+            return in_image ? add_fixup(m, P, KMODIMG_FIX_WORD, 0) : 0;
+
+        // PC-relative, only prelinked inside the image
+        case R_ARM_REL32:
+            if (!in_image)
+                return -1;
+
+            set32(m, P, ((S + get32(m, P)) | T) - P);
+            return 0;
+
+        case R_ARM_PREL31:
+        {
+            if (!in_image)
+                return -1;
+
+            elf32_sword off = (elf32_sword)(get32(m, P) << 1) >> 1;
+            off = ((S + off) | T) - P;
+            set32(m, P, (get32(m, P) & 0x80000000) | (off & 0x7fffffff));
+            return 0;
+        }
+
+        case R_ARM_THM_CALL:
+        case R_ARM_THM_JUMP24:
+            return branch(m, P, S);
+
+        case R_ARM_THM_JUMP11:
+            return in_image ? short_branch(m, P, S, 11) : -1;
+
+        case R_ARM_THM_JUMP8:
+            return in_image ? short_branch(m, P, S, 8) : -1;
+
+        case R_ARM_THM_MOVW_ABS_NC:
+        case R_ARM_THM_MOVT_ABS:
+        {
+            elf32_sword A = mov_get(m, P);
+            A = (A ^ 0x8000) - 0x8000;
+
+            elf32_word value = S + A;
+            if (r_type == R_ARM_THM_MOVW_ABS_NC)
+                value |= T;
+
+            if (r_type == R_ARM_THM_MOVT_ABS)
+            {
+                mov_set(m, P, value >> 16);
+                return in_image ? add_fixup(m, P, KMODIMG_FIX_MOVT, value & 0xffff) : 0;
+            }
+
+            mov_set(m, P, value);
+            return in_image ? add_fixup(m, P, KMODIMG_FIX_MOVW, 0) : 0;
+        }
+
+        default:
+            return -1;
+    }
+}
+
+//! Prelink a module
+//! \param k The kernel
+//! \param m The module
+//! \return 0 on success, -1 if it can't be prelinked
+static int prelink(struct kernel* k, struct module* m)
+{
+    m->header = (elf32_header*)m->blob.data;
+    if (m->blob.size < EEH_SIZE || memcmp(m->header->e_ident, elf32_magic, 4) || m->header->e_type != ET_REL)
+    {
+        fprintf(stderr, "modpost: not a relocatable ELF object\n");
+        return -1;
+    }
+
+    for (elf32_word i = 0; i < m->header->e_shnum; ++i)
+    {
+        elf32_shdr* shdr = section(m->header, i);
+        if (shdr->sh_type == SHT_SYMTAB)
+        {
+            m->symtab = shdr;
+            m->symstrtab = section(m->header, shdr->sh_link);
+        }
+        // Explicit addends are not supported by the kernel either
+        else if (shdr->sh_type == SHT_RELA)
+        {
+            fprintf(stderr, "modpost: relocations with explicit addends are not supported\n");
+            return -1;
+        }
+    }
+
+    if (!m->symtab || !m->symstrtab)
+    {
+        fprintf(stderr, "modpost: no symbol table\n");
+        return -1;
+    }
+
+    if (layout(m) < 0)
+        return -1;
+
+    for (elf32_word i = 0; i < m->header->e_shnum; ++i)
+    {
+        elf32_shdr* shdr = section(m->header, i);
+        if (shdr->sh_type != SHT_REL || shdr->sh_info >= m->header->e_shnum || m->shoff[shdr->sh_info] < 0)
+            continue;
+
+        for (elf32_word j = 0; j < shdr->sh_size / shdr->sh_entsize; ++j)
+        {
+            elf32_rel* rel = (elf32_rel*)(m->blob.data + shdr->sh_offset + j * shdr->sh_entsize);
+            if (relocate(k, m, shdr, rel) < 0)
+            {
+                fprintf(stderr, "modpost: relocation type %d against '%s' can't be prelinked\n",
+                        ELF32_R_TYPE(rel->r_info), symbol_name(m, symbol(m, ELF32_R_SYM(rel->r_info))));
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+//! Compare fixups by offset
+static int fixup_cmp(const void* a, const void* b)
+{
+    const struct fixup* fa = a;
+    const struct fixup* fb = b;
+
+    return (fa->offset > fb->offset) - (fa->offset < fb->offset);
+}
+
+//! Append an ULEB128 number to a buffer
+static int put_uleb(struct array* a, uint32_t value)
+{
+    do
+    {
+        uint8_t* byte = push(a);
+        if (!byte)
+            return -1;
+
+        *byte = value & 0x7f;
+        value >>= 7;
+        if (value)
+            *byte |= 0x80;
+    } while (value);
+
+    return 0;
+}
+
+//! Write the prelinked image
+//! \param k The kernel
+//! \param m The module
+//! \param path The output path
+//! \return 0 on success, -1 otherwise
+static int emit(struct kernel* k, struct module* m, const char* path)
+{
+    // Fixup stream, delta-encoded in half-words
+    struct array stream = {0, 0, 0, 1};
+
+    qsort(m->fixups.data, m->fixups.count, sizeof(struct fixup), fixup_cmp);
+
+    uint32_t last = 0;
+    for (int i = 0; i < m->fixups.count; ++i)
+    {
+        struct fixup* f = (struct fixup*)m->fixups.data + i;
+        if ((f->offset - last) & 1)
+        {
+            fprintf(stderr, "modpost: fixup at odd offset 0x%x can't be encoded\n", (unsigned)f->offset);
+            return -1;
+        }
+
+        if (put_uleb(&stream, ((f->offset - last) >> 1) << KMODIMG_FIX_BITS | f->kind) < 0)
+            return -1;
+        if (f->kind == KMODIMG_FIX_MOVT && put_uleb(&stream, f->low) < 0)
+            return -1;
+
+        last = f->offset;
+    }
+
+    // Symbol tables, exports are the module's defined global symbols
+    struct array symbols = {0, 0, 0, sizeof(struct kmodimg_symbol)};
+    struct array strtab = {0, 0, 0, 1};
+    int nexports = 0;
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        int count = pass == 0 ? m->imports.count : (int)(m->symtab->sh_size / m->symtab->sh_entsize);
+
+        for (int i = 0; i < count; ++i)
+        {
+            const char* name;
+            uint32_t offset;
+
+            if (pass == 0)
+            {
+                struct import* imp = (struct import*)m->imports.data + i;
+                name = imp->name;
+                offset = imp->offset;
+            }
+            else
+            {
+                elf32_sym* sym = symbol(m, i);
+                elf32_word bind = ELF32_ST_BIND(sym->st_info);
+                if ((bind != STB_GLOBAL && bind != STB_WEAK) || !sym->st_name)
+                    continue;
+                if (sym->st_shndx == SHN_UNDEF || sym->st_shndx >= m->header->e_shnum || m->shoff[sym->st_shndx] < 0)
+                    continue;
+
+                name = symbol_name(m, sym);
+                offset = m->shoff[sym->st_shndx] + sym->st_value;
+                if (ELF32_ST_TYPE(sym->st_info) == STT_FUNC)
+                    offset |= 0x01;
+                ++nexports;
+            }
+
+            struct kmodimg_symbol* s = push(&symbols);
+            if (!s)
+                return -1;
+
+            s->name = strtab.count;
+            s->offset = offset;
+
+            for (const char* c = name;; ++c)
+            {
+                char* byte = push(&strtab);
+                if (!byte)
+                    return -1;
+
+                *byte = *c;
+                if (!*c)
+                    break;
+            }
+        }
+    }
+
+    struct kmodimg_header header;
+    header.magic = KMODIMG_MAGIC;
+    header.ksymtab_sum = k->ksymtab_sum;
+    header.load_size = m->load_size;
+    header.copy_size = m->copy_size;
+    header.fixups_size = stream.count;
+    header.nimports = m->imports.count;
+    header.nexports = nexports;
+    header.strtab_size = strtab.count;
+
+    long size = sizeof(header) + KMODIMG_ALIGN(m->copy_size) + KMODIMG_ALIGN(stream.count) +
+                symbols.count * sizeof(struct kmodimg_symbol) + strtab.count;
+
+    char* out = calloc(size, 1);
+    if (!out)
+        return -1;
+
+    char* p = out;
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, m->image, m->copy_size);
+    p += KMODIMG_ALIGN(m->copy_size);
+    memcpy(p, stream.data, stream.count);
+    p += KMODIMG_ALIGN(stream.count);
+    memcpy(p, symbols.data, symbols.count * sizeof(struct kmodimg_symbol));
+    p += symbols.count * sizeof(struct kmodimg_symbol);
+    memcpy(p, strtab.data, strtab.count);
+
+    int err = write_blob(path, out, size);
+    free(out);
+
+    return err;
+}
+
+//! Compare strings from their end, so that a string comes
+//!   right after the longer ones it is a suffix of
+static int string_cmp(const void* a, const void* b)
+{
+    const struct string* sa = a;
+    const struct string* sb = b;
+
+    int i = sa->len;
+    int j = sb->len;
+    while (i > 0 && j > 0)
+    {
+        unsigned char ca = sa->str[--i];
+        unsigned char cb = sb->str[--j];
+        if (ca != cb)
+            return cb - ca;
+    }
+
+    return sb->len - sa->len;
+}
+
+//! Add a string to the merged string table
+//! \param strings The strings
+//! \param str The string
+//! \param dest Where to write its offset in the table
+//! \return 0 on success, -1 otherwise
+static int add_string(struct array* strings, const char* str, elf32_word* dest)
+{
+    struct string* s = push(strings);
+    if (!s)
+        return -1;
+
+    s->str = str;
+    s->len = strlen(str);
+    s->dest = dest;
+
+    return 0;
+}
+
+//! Build the merged string table, strings that are the
+//!   suffix of another one share its storage
+//! \param strings The strings, their offsets are written
+//! \param strtab The string table to fill
+//! \return 0 on success, -1 otherwise
+static int merge_strings(struct array* strings, struct array* strtab)
+{
+    qsort(strings->data, strings->count, sizeof(struct string), &string_cmp);
+
+    char* nul = push(strtab);
+    if (!nul)
+        return -1;
+
+    struct string* last = 0;
+    elf32_word last_offset = 0;
+
+    for (int i = 0; i < strings->count; ++i)
+    {
+        struct string* s = (struct string*)strings->data + i;
+
+        if (!s->len)
+        {
+            *s->dest = 0;
+        }
+        else if (last && last->len >= s->len && memcmp(last->str + last->len - s->len, s->str, s->len) == 0)
+        {
+            *s->dest = last_offset + last->len - s->len;
+        }
+        else
+        {
+            *s->dest = last_offset = strtab->count;
+            last = s;
+
+            for (int c = 0; c <= s->len; ++c)
+            {
+                char* byte = push(strtab);
+                if (!byte)
+                    return -1;
+                *byte = s->str[c];
+            }
+        }
+    }
+
+    return 0;
+}
+
+//! Compact an ELF module : drop the sections the kernel does not
+//!   read (debug info, comments, attributes...) and the local symbols
+//!   no relocation uses, and merge the string tables into one
+//! \param in The module
+//! \param out The compacted module (to be freed)
+//! \return 0 on success, -1 if it can't be compacted
+static int compact(const struct blob* in, struct blob* out)
+{
+    elf32_header* h = (elf32_header*)in->data;
+    if (in->size < EEH_SIZE || memcmp(h->e_ident, elf32_magic, 4) || h->e_type != ET_REL)
+        return -1;
+    if (h->e_shentsize != sizeof(elf32_shdr) || h->e_shoff + h->e_shnum * sizeof(elf32_shdr) > (unsigned long)in->size)
+        return -1;
+
+    elf32_word nsh = h->e_shnum;
+    elf32_word symtab_id = 0;
+    for (elf32_word i = 1; i < nsh; ++i)
+    {
+        if (section(h, i)->sh_type == SHT_SYMTAB)
+            symtab_id = i;
+    }
+
+    elf32_shdr* symtab = section(h, symtab_id);
+    elf32_shdr* symstrtab = symtab_id ? section(h, symtab->sh_link) : 0;
+    if (!symstrtab || symtab->sh_entsize != sizeof(elf32_sym))
+        return -1;
+
+    elf32_word nsyms = symtab->sh_size / sizeof(elf32_sym);
+    elf32_sym* syms = (elf32_sym*)(in->data + symtab->sh_offset);
+    const char* names = in->data + symstrtab->sh_offset;
+
+    // New section indexes (0 for dropped sections), the
+    //   merged string table comes last
+    elf32_word* shmap = calloc(nsh, sizeof(elf32_word));
+    elf32_word* symmap = calloc(nsyms, sizeof(elf32_word));
+    elf32_shdr* shdrs = calloc(nsh + 1, sizeof(elf32_shdr));
+    elf32_sym* newsyms = calloc(nsyms, sizeof(elf32_sym));
+    struct array strings = {0, 0, 0, sizeof(struct string)};
+    struct array strtab = {0, 0, 0, 1};
+    int err = -1;
+
+    if (!shmap || !symmap || !shdrs || !newsyms)
+        goto out;
+
+    // Program sections, the symbol table, and the
+    //   relocations of program sections
+    elf32_word count = 1;
+    for (elf32_word i = 1; i < nsh; ++i)
+    {
+        elf32_shdr* shdr = section(h, i);
+        if ((shdr->sh_flags & SHF_ALLOC) || i == symtab_id)
+            shmap[i] = count++;
+    }
+
+    for (elf32_word i = 1; i < nsh; ++i)
+    {
+        elf32_shdr* shdr = section(h, i);
+        if (shdr->sh_type != SHT_REL && shdr->sh_type != SHT_RELA)
+            continue;
+        if (shdr->sh_info >= nsh || !shmap[shdr->sh_info] || shdr->sh_link != symtab_id)
+            continue;
+
+        // The kernel can't use them either
+        if (shdr->sh_type == SHT_RELA || shdr->sh_entsize != sizeof(elf32_rel))
+            goto out;
+
+        shmap[i] = count++;
+
+        // Keep the symbols they use
+        for (elf32_word j = 0; j < shdr->sh_size / sizeof(elf32_rel); ++j)
+        {
+            elf32_rel* rel = (elf32_rel*)(in->data + shdr->sh_offset) + j;
+            if (ELF32_R_SYM(rel->r_info) >= nsyms)
+                goto out;
+
+            symmap[ELF32_R_SYM(rel->r_info)] = 1;
+        }
+    }
+
+    elf32_word strtab_id = count++;
+
+    // The null symbol is kept as is
+    symmap[0] = 0;
+
+    // Locals come first, then globals (sh_info of the
+    //   symbol table is the first global's index)
+    elf32_word nnew = 1;
+    elf32_word first_global = 0;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        if (pass)
+            first_global = nnew;
+
+        for (elf32_word i = 1; i < nsyms; ++i)
+        {
+            elf32_sym* sym = syms + i;
+            int local = ELF32_ST_BIND(sym->st_info) == STB_LOCAL;
+
+            // Unused locals (file names, labels...) are dropped
+            if (local != (pass == 0) || (local && !symmap[i]))
+                continue;
+
+            elf32_sym* s = newsyms + nnew;
+            *s = *sym;
+
+            if (sym->st_shndx != SHN_UNDEF && sym->st_shndx < SHN_LORESERVE)
+            {
+                if (sym->st_shndx >= nsh || !shmap[sym->st_shndx])
+                    goto out;
+                s->st_shndx = shmap[sym->st_shndx];
+            }
+
+            if (sym->st_name && add_string(&strings, names + sym->st_name, &s->st_name) < 0)
+                goto out;
+
+            symmap[i] = nnew++;
+        }
+    }
+
+    // Section headers
+    for (elf32_word i = 1; i < nsh; ++i)
+    {
+        if (!shmap[i])
+            continue;
+
+        elf32_shdr* shdr = section(h, i);
+        elf32_shdr* s = shdrs + shmap[i];
+        *s = *shdr;
+        s->sh_flags &= ~SHF_GROUP;
+
+        if (i == symtab_id)
+        {
+            s->sh_link = strtab_id;
+            s->sh_info = first_global;
+            s->sh_size = nnew * sizeof(elf32_sym);
+        }
+        else if (shdr->sh_type == SHT_REL)
+        {
+            s->sh_link = shmap[symtab_id];
+            s->sh_info = shmap[shdr->sh_info];
+        }
+        else
+        {
+            s->sh_link = shdr->sh_link < nsh ? shmap[shdr->sh_link] : 0;
+            if (shdr->sh_flags & SHF_INFO_LINK)
+                s->sh_info = shdr->sh_info < nsh ? shmap[shdr->sh_info] : 0;
+        }
+
+        if (add_string(&strings, section_name(h, shdr), &s->sh_name) < 0)
+            goto out;
+    }
+
+    elf32_shdr* strtab_shdr = shdrs + strtab_id;
+    strtab_shdr->sh_type = SHT_STRTAB;
+    strtab_shdr->sh_addralign = 1;
+    if (add_string(&strings, ".strtab", &strtab_shdr->sh_name) < 0)
+        goto out;
+
+    if (merge_strings(&strings, &strtab) < 0)
+        goto out;
+    strtab_shdr->sh_size = strtab.count;
+
+    // Lay the sections out, then the section header table
+    elf32_off off = EEH_SIZE;
+    for (elf32_word i = 1; i < count; ++i)
+    {
+        elf32_shdr* s = shdrs + i;
+        elf32_word align = s->sh_addralign ? s->sh_addralign : 1;
+        if (s->sh_type == SHT_SYMTAB || s->sh_type == SHT_REL)
+            align = sizeof(elf32_word);
+
+        off = (off + align - 1) & ~(align - 1);
+        s->sh_offset = off;
+        if (s->sh_type != SHT_NOBITS)
+            off += s->sh_size;
+    }
+
+    off = (off + sizeof(elf32_word) - 1) & ~(sizeof(elf32_word) - 1);
+
+    out->size = off + count * sizeof(elf32_shdr);
+    out->data = calloc(out->size, 1);
+    if (!out->data)
+        goto out;
+
+    elf32_header* oh = (elf32_header*)out->data;
+    memcpy(oh, h, EEH_SIZE);
+    oh->e_phoff = 0;
+    oh->e_phnum = 0;
+    oh->e_shoff = off;
+    oh->e_shnum = count;
+    oh->e_shstrndx = strtab_id;
+
+    for (elf32_word i = 1; i < nsh; ++i)
+    {
+        if (!shmap[i])
+            continue;
+
+        elf32_shdr* shdr = section(h, i);
+        elf32_shdr* s = shdrs + shmap[i];
+        char* dst = out->data + s->sh_offset;
+
+        if (i == symtab_id)
+        {
+            memcpy(dst, newsyms, s->sh_size);
+        }
+        else if (shdr->sh_type == SHT_REL)
+        {
+            elf32_rel* rel = (elf32_rel*)dst;
+            memcpy(rel, in->data + shdr->sh_offset, s->sh_size);
+
+            for (elf32_word j = 0; j < s->sh_size / sizeof(elf32_rel); ++j)
+            {
+                elf32_word r_sym = symmap[ELF32_R_SYM(rel[j].r_info)];
+                rel[j].r_info = (r_sym << 8) | ELF32_R_TYPE(rel[j].r_info);
+            }
+        }
+        else if (shdr->sh_type != SHT_NOBITS)
+        {
+            memcpy(dst, in->data + shdr->sh_offset, s->sh_size);
+        }
+    }
+
+    memcpy(out->data + strtab_shdr->sh_offset, strtab.data, strtab.count);
+    memcpy(out->data + off, shdrs, count * sizeof(elf32_shdr));
+
+    err = 0;
+
+out:
+    free(shmap);
+    free(symmap);
+    free(shdrs);
+    free(newsyms);
+    free(strings.data);
+    free(strtab.data);
+
+    return err;
+}
+
+//////////////////////
+//// Main program ////
+//////////////////////
+
+//! Write an ELF module compacted, or as is if it can't be
+//! \param module The module
+//! \param path The output's path
+//! \return 0 on success, -1 otherwise
+static int write_compacted(struct blob* module, const char* path)
+{
+    struct blob out;
+    if (compact(module, &out) < 0)
+    {
+        fprintf(stderr, "modpost: '%s' can't be compacted, keeping it as is\n", path);
+        return write_blob(path, module->data, module->size);
+    }
+
+    printf("modpost: '%s' compacted, %ld -> %ld bytes (-%ld%%)\n", path, module->size, out.size,
+           module->size ? 100 * (module->size - out.size) / module->size : 0);
+
+    int err = write_blob(path, out.data, out.size);
+    free(out.data);
+
+    return err;
+}
+
+int main(int argc, char** argv)
+{
+    const char* prog = argv[0];
+
+    // Prelinking failures are errors with -W
+    int strict = argc == 5 && strcmp(argv[1], "-W") == 0;
+    if (strict)
+    {
+        --argc;
+        ++argv;
+    }
+
+    int only_compact = argc == 4 && strcmp(argv[1], "-c") == 0;
+
+    if (argc != 4 || (strict && only_compact))
+    {
+        fprintf(stderr, "usage: %s [-W] <kernel elf> <module> <output>\n", prog);
+        fprintf(stderr, "       %s -c <module> <output>\n", prog);
+        return 1;
+    }
+
+    struct kernel k;
+    struct module m;
+    memset(&k, 0, sizeof(k));
+    memset(&m, 0, sizeof(m));
+
+    m.fixups.elsize = sizeof(struct fixup);
+    m.imports.elsize = sizeof(struct import);
+    m.veneers.elsize = sizeof(struct veneer);
+
+    if (!only_compact && (read_blob(argv[1], &k.blob) < 0 || load_kernel(&k) < 0))
+    {
+        fprintf(stderr, "modpost: unable to read the kernel symbol table from '%s'\n", argv[1]);
+        return 1;
+    }
+
+    if (read_blob(argv[2], &m.blob) < 0)
+    {
+        fprintf(stderr, "modpost: unable to read '%s'\n", argv[2]);
+        return 1;
+    }
+
+    if (!only_compact)
+    {
+        if (prelink(&k, &m) == 0 && emit(&k, &m, argv[3]) == 0)
+            return 0;
+
+        if (strict)
+        {
+            fprintf(stderr, "modpost: error: '%s' can't be prelinked\n", argv[2]);
+            return 1;
+        }
+
+        // Let the kernel link it at load time
+        fprintf(stderr, "modpost: warning: '%s' not prelinked, keeping the ELF module\n", argv[2]);
+    }
+
+    if (write_compacted(&m.blob, argv[3]) < 0)
+    {
+        fprintf(stderr, "modpost: unable to write '%s'\n", argv[3]);
+        return 1;
+    }
+
+    return 0;
+}